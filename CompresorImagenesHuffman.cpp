@@ -2,104 +2,2213 @@
 #include <fstream>
 #include <vector>
 #include <queue>
-#include <map>
 #include <string>
 #include <functional>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <memory>
+#include <type_traits>
 #include <zlib.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#include "TablasHuffman.h"
 
+// Tree node stored in a NodeArena; children are arena indices, -1 for none.
 struct Node {
-    char ch;
-    int freq;
-    Node* left;
-    Node* right;
+    uint64_t freq;
+    int16_t left;
+    int16_t right;
+    unsigned char ch;
+};
+
+// 256 leaves plus at most 255 internal nodes. Nodes live inline, so a tree is
+// built without heap allocation and released with the arena that owns it.
+struct NodeArena {
+    std::array<Node, 511> nodes;
+    int count = 0;
+
+    int add(unsigned char ch, uint64_t freq, int left, int right) {
+        nodes[count] = Node{freq, static_cast<int16_t>(left), static_cast<int16_t>(right), ch};
+        return count++;
+    }
+
+    void clear() {
+        count = 0;
+    }
+};
+
+struct Patient {
+    std::string name;
+    int age;
+    float height;
+    float weight;
+    std::string diagnosisDate;
+    std::string diagnosis;
+};
+
+struct compare {
+    const NodeArena* arena;
+    bool operator()(int l, int r) const {
+        return arena->nodes[l].freq > arena->nodes[r].freq;
+    }
+};
+
+typedef std::array<uint64_t, 256> Histogram;
+
+// Bytes handed to each histogram task; small images are counted on one thread.
+const size_t kHistogramSlice = 1 << 22;
+
+// Runs body(i) for every i in [0, count) on up to hardware_concurrency() threads.
+void parallelFor(size_t count, const std::function<void(size_t)>& body) {
+    size_t workers = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++) body(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        threads.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) body(i);
+        });
+    }
+    for (std::thread& t : threads) t.join();
+}
+
+// Counts data[0, size) into four interleaved sub-histograms so runs of the same
+// byte do not stall on a store-to-load dependency through a single counter.
+void countBytes(const unsigned char* data, size_t size, Histogram& freq) {
+    uint32_t sub[4][256] = {};
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        sub[0][data[i]]++;
+        sub[1][data[i + 1]]++;
+        sub[2][data[i + 2]]++;
+        sub[3][data[i + 3]]++;
+    }
+    for (; i < size; i++) {
+        sub[0][data[i]]++;
+    }
+    for (int s = 0; s < 256; s++) {
+        freq[s] += static_cast<uint64_t>(sub[0][s]) + sub[1][s] + sub[2][s] + sub[3][s];
+    }
+}
+
+Histogram buildHistogram(const std::vector<unsigned char>& data) {
+    size_t slices = (data.size() + kHistogramSlice - 1) / kHistogramSlice;
+    std::vector<Histogram> partial(slices, Histogram{});
+    parallelFor(slices, [&](size_t i) {
+        size_t begin = i * kHistogramSlice;
+        size_t size = std::min(kHistogramSlice, data.size() - begin);
+        countBytes(data.data() + begin, size, partial[i]);
+    });
+
+    Histogram freq{};
+    for (const Histogram& h : partial) {
+        for (int s = 0; s < 256; s++) freq[s] += h[s];
+    }
+    return freq;
+}
+
+// Bits of PapHeader::transforms; each one marks a reversible stage applied
+// before entropy coding, which RecuperarImagenDatos undoes in reverse order.
+const uint32_t kTransformFilter = 1 << 0;
+const uint32_t kTransformColor = 1 << 1;
+const uint32_t kTransformPlanar = 1 << 2;
+const uint32_t kTransformReduce = 1 << 3;
+const uint32_t kTransformPalette = 1 << 4;
+const uint32_t kTransformLowBits = 1 << 5;
+const uint32_t kTransformWide = 1 << 6;
+
+// Entropy backend that produced the data section, stored in PapHeader::codec.
+enum Codec {
+    CODEC_HUFFMAN = 0,
+    CODEC_LOCO = 1,
+    CODEC_RANS = 2,
+    CODEC_FSE = 3,
+    CODEC_ARITH = 4,
+    CODEC_STATIC_HUFFMAN = 5,
+    CODEC_PAIRS = 6,
+    CODEC_BWT = 7,
+    CODEC_LZ = 8,
+    CODEC_RLE = 9,
+    CODEC_STREAM = 10
+};
+
+struct PapHeader {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    uint32_t codec = CODEC_HUFFMAN;
+    uint32_t transforms = 0;
+    // Parameters of the enabled transforms, appended in the order they run
+    std::string transformData;
+};
+
+// PNG prediction filters. The encoder stores the residual x - predictor
+// modulo the sample range (256, or 65536 for 16-bit images) and the decoder
+// adds the predictor back.
+enum FilterType {
+    FILTER_NONE = 0,
+    FILTER_SUB,
+    FILTER_UP,
+    FILTER_AVERAGE,
+    FILTER_PAETH,
+    FILTER_COUNT
+};
+
+// --filter=auto picks the filter per row; any other value forces one filter.
+const int kFilterAuto = -1;
+
+// Rows handed to each filtering task.
+const int kFilterRowBatch = 16;
+
+inline int paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// Filters one row of rowSamples samples; prev is the unfiltered row above
+// (all zeros for row 0) and bpp is the distance to the left neighbour, i.e.
+// the channel count. The kernel is instantiated per sample type and channel
+// count so the neighbour offset is a constant the compiler can unroll
+// around; Channels == 0 reads it from bpp. Storing into Sample wraps the
+// residual to the sample range.
+template <typename Sample, int Channels>
+void filterRowKernel(int type, const Sample* row, const Sample* prev, size_t rowSamples, size_t runtimeBpp, Sample* out) {
+    const size_t bpp = Channels > 0 ? Channels : runtimeBpp;
+    size_t i = 0;
+    switch (type) {
+    case FILTER_NONE:
+        std::memcpy(out, row, rowSamples * sizeof(Sample));
+        break;
+    case FILTER_SUB:
+        for (; i < bpp && i < rowSamples; i++) out[i] = row[i];
+        for (; i < rowSamples; i++) out[i] = row[i] - row[i - bpp];
+        break;
+    case FILTER_UP:
+        for (; i < rowSamples; i++) out[i] = row[i] - prev[i];
+        break;
+    case FILTER_AVERAGE:
+        for (; i < bpp && i < rowSamples; i++) out[i] = row[i] - (prev[i] >> 1);
+        for (; i < rowSamples; i++) out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+        break;
+    case FILTER_PAETH:
+        for (; i < bpp && i < rowSamples; i++) out[i] = row[i] - prev[i];
+        for (; i < rowSamples; i++) out[i] = row[i] - paethPredictor(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    }
+}
+
+template <typename Sample>
+using FilterRowKernel = void (*)(int, const Sample*, const Sample*, size_t, size_t, Sample*);
+
+// Picks the instantiation for the pixel sizes stbi_load() produces.
+template <typename Sample>
+FilterRowKernel<Sample> selectFilterRowKernel(int bpp) {
+    switch (bpp) {
+    case 1: return filterRowKernel<Sample, 1>;
+    case 2: return filterRowKernel<Sample, 2>;
+    case 3: return filterRowKernel<Sample, 3>;
+    case 4: return filterRowKernel<Sample, 4>;
+    default: return filterRowKernel<Sample, 0>;
+    }
+}
+
+// PNG's heuristic: the residuals are read as signed values and the row with
+// the smallest sum of magnitudes usually entropy-codes best.
+template <typename Sample>
+uint64_t residualCost(const Sample* residuals, size_t size) {
+    typedef typename std::make_signed<Sample>::type Signed;
+    uint64_t cost = 0;
+    for (size_t i = 0; i < size; i++) {
+        cost += std::abs(static_cast<int>(static_cast<Signed>(residuals[i])));
+    }
+    return cost;
+}
+
+// Replaces every row with its prediction residuals. Rows only read the
+// original image, so batches of rows are filtered in parallel; the chosen
+// filter of each row is returned in rowFilters.
+template <typename Sample>
+std::vector<Sample> filterImage(const std::vector<Sample>& data, int width, int height, int channels, int mode, std::vector<unsigned char>& rowFilters) {
+    size_t rowSamples = static_cast<size_t>(width) * channels;
+    std::vector<Sample> filtered(data.size());
+    std::vector<Sample> zeroRow(rowSamples, 0);
+    rowFilters.assign(height, FILTER_NONE);
+    FilterRowKernel<Sample> filterRow = selectFilterRowKernel<Sample>(channels);
+
+    parallelFor((height + kFilterRowBatch - 1) / kFilterRowBatch, [&](size_t batch) {
+        std::vector<Sample> candidate(rowSamples);
+        int end = std::min(height, static_cast<int>((batch + 1) * kFilterRowBatch));
+        for (int y = static_cast<int>(batch * kFilterRowBatch); y < end; y++) {
+            const Sample* row = &data[y * rowSamples];
+            const Sample* prev = y > 0 ? row - rowSamples : zeroRow.data();
+            Sample* out = &filtered[y * rowSamples];
+
+            int best = mode;
+            if (mode == kFilterAuto) {
+                uint64_t bestCost = UINT64_MAX;
+                for (int type = FILTER_NONE; type < FILTER_COUNT; type++) {
+                    filterRow(type, row, prev, rowSamples, channels, candidate.data());
+                    uint64_t cost = residualCost(candidate.data(), rowSamples);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        best = type;
+                    }
+                }
+            }
+            filterRow(best, row, prev, rowSamples, channels, out);
+            rowFilters[y] = static_cast<unsigned char>(best);
+        }
+    });
+    return filtered;
+}
+
+// Pixels per color kernel block and blocks per parallel task. Each block is
+// split into planes so the lifting steps run as plain loops over byte arrays,
+// which the compiler vectorizes.
+const size_t kColorBlock = 64;
+const size_t kColorBlocksPerTask = 4096;
+
+// Lossless YCoCg-R on the first three channels, computed modulo 256 so each
+// plane stays one byte. Every lifting step adds a function of the other planes
+// and is undone exactly by subtracting it; a fourth channel is left untouched.
+template <int Channels>
+void forwardColorKernel(std::vector<unsigned char>& data) {
+    const size_t channels = Channels;
+    size_t pixels = data.size() / channels;
+    size_t blocks = (pixels + kColorBlock - 1) / kColorBlock;
+    parallelFor((blocks + kColorBlocksPerTask - 1) / kColorBlocksPerTask, [&](size_t task) {
+        unsigned char r[kColorBlock] = {}, g[kColorBlock] = {}, b[kColorBlock] = {};
+        size_t end = std::min(pixels, (task + 1) * kColorBlocksPerTask * kColorBlock);
+        for (size_t first = task * kColorBlocksPerTask * kColorBlock; first < end; first += kColorBlock) {
+            size_t n = std::min(kColorBlock, end - first);
+            unsigned char* p = &data[first * channels];
+            for (size_t i = 0; i < n; i++) {
+                r[i] = p[i * channels];
+                g[i] = p[i * channels + 1];
+                b[i] = p[i * channels + 2];
+            }
+            // Full-width pass: a fixed trip count vectorizes at -O2; tail lanes are discarded
+            for (size_t i = 0; i < kColorBlock; i++) {
+                unsigned char co = r[i] - b[i];
+                unsigned char t = b[i] + (static_cast<signed char>(co) >> 1);
+                unsigned char cg = g[i] - t;
+                r[i] = t + (static_cast<signed char>(cg) >> 1);
+                g[i] = co;
+                b[i] = cg;
+            }
+            for (size_t i = 0; i < n; i++) {
+                p[i * channels] = r[i];
+                p[i * channels + 1] = g[i];
+                p[i * channels + 2] = b[i];
+            }
+        }
+    });
+}
+
+// Only 3 and 4 channels carry RGB; the kernel is instantiated for each.
+void forwardColorTransform(std::vector<unsigned char>& data, int channels) {
+    if (channels == 3) {
+        forwardColorKernel<3>(data);
+    } else {
+        forwardColorKernel<4>(data);
+    }
+}
+
+// Channel reduction: grayscale scans saved as RGB(A) and constant alpha are
+// found before any other stage and the redundant channels are dropped. The
+// stage records the original channel count and the alpha value (one sample);
+// the stored count is PapHeader::channels.
+const size_t kReduceBlock = 64;
+
+// Appends one sample to the transform parameters in host byte order.
+template <typename Sample>
+void appendSample(std::string& out, Sample value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Whole blocks are scanned as flat sample arrays, with masks picking each
+// pixel's color or alpha lanes; the last block is checked pixel by pixel.
+template <typename Sample, int Channels>
+void findRedundantChannels(const Sample* p, size_t pixels, bool& gray, bool& constantAlpha) {
+    const bool hasColor = Channels >= 3;
+    const bool hasAlpha = Channels == 2 || Channels == 4;
+    const size_t blockSamples = kReduceBlock * Channels;
+    const Sample alpha = hasAlpha ? p[Channels - 1] : 0;
+    gray = hasColor;
+    constantAlpha = hasAlpha;
+
+    Sample colorMask[blockSamples], alphaMask[blockSamples];
+    for (size_t j = 0; j < blockSamples; j++) {
+        size_t c = j % Channels;
+        colorMask[j] = hasColor && c < 2 ? static_cast<Sample>(~Sample(0)) : 0;
+        alphaMask[j] = hasAlpha && c == Channels - 1 ? static_cast<Sample>(~Sample(0)) : 0;
+    }
+
+    // The color loop reads one sample past the block (masked out), so the
+    // final block always takes the per-pixel path
+    size_t blockEnd = pixels > 0 ? (pixels - 1) / kReduceBlock * kReduceBlock : 0;
+    size_t first = 0;
+    for (; first < blockEnd && (gray || constantAlpha); first += kReduceBlock) {
+        const Sample* q = p + first * Channels;
+        Sample colorDiff = 0, alphaDiff = 0;
+        if (hasColor) {
+            for (size_t j = 0; j < blockSamples; j++) colorDiff |= (q[j] ^ q[j + 1]) & colorMask[j];
+        }
+        if (hasAlpha) {
+            for (size_t j = 0; j < blockSamples; j++) alphaDiff |= (q[j] ^ alpha) & alphaMask[j];
+        }
+        if (colorDiff) gray = false;
+        if (alphaDiff) constantAlpha = false;
+    }
+    for (size_t i = first; i < pixels && (gray || constantAlpha); i++) {
+        const Sample* q = p + i * Channels;
+        if (hasColor && (q[0] != q[1] || q[0] != q[2])) gray = false;
+        if (hasAlpha && q[Channels - 1] != alpha) constantAlpha = false;
+    }
+}
+
+// Drops the redundant channels in place; returns false when there are none.
+template <typename Sample>
+bool reduceChannels(std::vector<Sample>& data, PapHeader& header) {
+    int channels = header.channels;
+    size_t pixels = data.size() / channels;
+    bool gray = false, constantAlpha = false;
+    switch (channels) {
+    case 2: findRedundantChannels<Sample, 2>(data.data(), pixels, gray, constantAlpha); break;
+    case 3: findRedundantChannels<Sample, 3>(data.data(), pixels, gray, constantAlpha); break;
+    case 4: findRedundantChannels<Sample, 4>(data.data(), pixels, gray, constantAlpha); break;
+    default: return false;
+    }
+    if (!gray && !constantAlpha) return false;
+
+    bool hasAlpha = channels == 2 || channels == 4;
+    Sample alpha = hasAlpha ? data[channels - 1] : 0;
+    int colorOut = gray || channels < 3 ? 1 : 3;
+    bool keepAlpha = hasAlpha && !constantAlpha;
+    int reduced = colorOut + (keepAlpha ? 1 : 0);
+    // Pixel i is written at or before where it was read, so one forward pass is safe
+    for (size_t i = 0; i < pixels; i++) {
+        const Sample* in = &data[i * channels];
+        Sample* out = &data[i * reduced];
+        Sample a = in[channels - 1];
+        for (int c = 0; c < colorOut; c++) out[c] = in[c];
+        if (keepAlpha) out[colorOut] = a;
+    }
+    data.resize(pixels * reduced);
+
+    header.transforms |= kTransformReduce;
+    header.transformData.push_back(static_cast<char>(channels));
+    appendSample(header.transformData, alpha);
+    header.channels = reduced;
+    return true;
+}
+
+// Palette mode: images with at most kMaxPaletteColors distinct pixels are
+// stored as one index byte per pixel. The stage records the channel count,
+// the number of colors minus one and the palette entries.
+const size_t kMaxPaletteColors = 256;
+const int kPaletteHashBits = 10;
+const size_t kPaletteSlots = size_t(1) << kPaletteHashBits;
+
+// Open-addressing set of packed pixels, sized so it never fills up before the
+// color limit is reached. Once the palette is sorted each slot holds its index.
+struct ColorSet {
+    std::array<uint32_t, kPaletteSlots> keys;
+    std::array<int16_t, kPaletteSlots> values;  // -1 marks a free slot
+    ColorSet() { values.fill(-1); }
+    size_t slot(uint32_t key) const {
+        size_t s = (key * 2654435761u) >> (32 - kPaletteHashBits);
+        while (values[s] >= 0 && keys[s] != key) s = (s + 1) & (kPaletteSlots - 1);
+        return s;
+    }
+};
+
+template <int Channels>
+inline uint32_t packPixel(const unsigned char* p) {
+    uint32_t key = 0;
+    for (int c = 0; c < Channels; c++) key |= uint32_t(p[c]) << (8 * c);
+    return key;
+}
+
+// Collects the distinct pixels, giving up as soon as there are too many.
+// Runs of one color are common in this kind of image and skip the hash.
+template <int Channels>
+bool collectColors(const unsigned char* p, size_t pixels, ColorSet& set, std::vector<uint32_t>& colors) {
+    uint32_t previous = packPixel<Channels>(p) ^ 1;
+    for (size_t i = 0; i < pixels; i++) {
+        uint32_t key = packPixel<Channels>(p + i * Channels);
+        if (key == previous) continue;
+        previous = key;
+        size_t s = set.slot(key);
+        if (set.values[s] >= 0) continue;
+        if (colors.size() == kMaxPaletteColors) return false;
+        set.keys[s] = key;
+        set.values[s] = 0;
+        colors.push_back(key);
+    }
+    return true;
+}
+
+template <int Channels>
+void indexColors(const unsigned char* p, size_t pixels, const ColorSet& set, unsigned char* out) {
+    uint32_t previous = packPixel<Channels>(p);
+    unsigned char index = static_cast<unsigned char>(set.values[set.slot(previous)]);
+    for (size_t i = 0; i < pixels; i++) {
+        uint32_t key = packPixel<Channels>(p + i * Channels);
+        if (key != previous) {
+            previous = key;
+            index = static_cast<unsigned char>(set.values[set.slot(key)]);
+        }
+        out[i] = index;
+    }
+}
+
+// Replaces the pixels with palette indices in place; returns false when the
+// image has too many colors or the palette would be a large share of it.
+// Whether the indices actually code smaller is decided by the caller. The
+// palette is sorted by brightness so nearby indices are similar colors and
+// the filters still have something to predict.
+bool paletteImage(std::vector<unsigned char>& data, PapHeader& header) {
+    int channels = header.channels;
+    size_t pixels = data.size() / channels;
+    if (pixels == 0) return false;
+    ColorSet set;
+    std::vector<uint32_t> colors;
+    bool fits = false;
+    switch (channels) {
+    case 2: fits = collectColors<2>(data.data(), pixels, set, colors); break;
+    case 3: fits = collectColors<3>(data.data(), pixels, set, colors); break;
+    case 4: fits = collectColors<4>(data.data(), pixels, set, colors); break;
+    default: return false;
+    }
+    // A palette with one entry for every other pixel cannot pay for itself
+    if (!fits || colors.size() * 2 > pixels) return false;
+
+    auto brightness = [channels](uint32_t key) {
+        int colorChannels = channels >= 3 ? 3 : 1;
+        uint32_t sum = 0;
+        for (int c = 0; c < colorChannels; c++) sum += (key >> (8 * c)) & 0xFF;
+        return sum;
+    };
+    std::sort(colors.begin(), colors.end(), [&](uint32_t a, uint32_t b) {
+        uint32_t ba = brightness(a), bb = brightness(b);
+        return ba != bb ? ba < bb : a < b;
+    });
+    for (size_t i = 0; i < colors.size(); i++) set.values[set.slot(colors[i])] = static_cast<int16_t>(i);
+
+    // Indices are written at or before the pixel they replace
+    switch (channels) {
+    case 2: indexColors<2>(data.data(), pixels, set, data.data()); break;
+    case 3: indexColors<3>(data.data(), pixels, set, data.data()); break;
+    case 4: indexColors<4>(data.data(), pixels, set, data.data()); break;
+    }
+    data.resize(pixels);
+
+    header.transforms |= kTransformPalette;
+    header.transformData.push_back(static_cast<char>(channels));
+    header.transformData.push_back(static_cast<char>(colors.size() - 1));
+    for (uint32_t key : colors) {
+        for (int c = 0; c < channels; c++) header.transformData.push_back(static_cast<char>(key >> (8 * c)));
+    }
+    header.channels = 1;
+    return true;
+}
+
+// Low-bit packing: data from a detector with fewer bits than the container
+// leaves the low bits of every sample constant (usually zero). The stage
+// records the shift and the value of the dropped bits (one sample).
+const size_t kLowBitsBlock = 4096;
+
+// Returns the bits that differ between at least two samples. The buffer is
+// OR/AND-reduced eight bytes at a time, folding the lanes after each block so
+// the scan can stop as soon as bit 0 is known to vary.
+template <typename Sample>
+Sample varyingBits(const Sample* p, size_t count) {
+    const size_t lanes = 8 / sizeof(Sample);
+    uint64_t orAll = 0, andAll = ~uint64_t(0);
+    Sample orSample = 0, andSample = static_cast<Sample>(~Sample(0));
+    size_t words = count / lanes;
+    for (size_t first = 0; first < words; first += kLowBitsBlock) {
+        size_t last = std::min(words, first + kLowBitsBlock);
+        for (size_t i = first; i < last; i++) {
+            uint64_t w;
+            std::memcpy(&w, p + i * lanes, 8);
+            orAll |= w;
+            andAll &= w;
+        }
+        for (size_t lane = 0; lane < lanes; lane++) {
+            orSample |= static_cast<Sample>(orAll >> (8 * sizeof(Sample) * lane));
+            andSample &= static_cast<Sample>(andAll >> (8 * sizeof(Sample) * lane));
+        }
+        if ((orSample ^ andSample) & 1) return orSample ^ andSample;
+    }
+    for (size_t i = words * lanes; i < count; i++) {
+        orSample |= p[i];
+        andSample &= p[i];
+    }
+    return orSample ^ andSample;
+}
+
+// Shifts the constant low bits out of every sample; returns false when bit 0
+// already varies. A completely flat image keeps one bit so it still has data.
+template <typename Sample>
+bool shiftOutLowBits(std::vector<Sample>& data, PapHeader& header) {
+    if (data.empty()) return false;
+    Sample varying = varyingBits(data.data(), data.size());
+    int shift = varying ? __builtin_ctz(varying) : static_cast<int>(8 * sizeof(Sample)) - 1;
+    if (shift == 0) return false;
+    Sample low = data[0] & ((1u << shift) - 1);
+    for (Sample& v : data) v >>= shift;
+
+    header.transforms |= kTransformLowBits;
+    header.transformData.push_back(static_cast<char>(shift));
+    appendSample(header.transformData, low);
+    return true;
+}
+
+// 16-bit images are coded as byte planes: every sample becomes a high and a
+// low byte, interleaved as two byte channels and always coded in planar mode
+// so each plane gets its own statistics. Filter residuals are zigzag-mapped
+// first so small negative values keep a zero high byte and the sign lands
+// in the low plane, instead of being paid for in both planes.
+inline uint16_t zigzag16(uint16_t residual) {
+    return static_cast<uint16_t>((residual << 1) ^ (residual & 0x8000 ? 0xFFFF : 0));
+}
+
+std::vector<unsigned char> splitBytePlanes(const std::vector<uint16_t>& samples, bool residuals) {
+    std::vector<unsigned char> bytes(samples.size() * 2);
+    for (size_t i = 0; i < samples.size(); i++) {
+        uint16_t v = residuals ? zigzag16(samples[i]) : samples[i];
+        bytes[2 * i] = static_cast<unsigned char>(v >> 8);
+        bytes[2 * i + 1] = static_cast<unsigned char>(v);
+    }
+    return bytes;
+}
+
+typedef std::array<uint8_t, 256> CodeLengths;
+
+// Bounds for --max-code-length; 8 bits always fits 256 symbols and 15 keeps the
+// decoder's single-level lookup table at 32K entries.
+const int kMinCodeLength = 8;
+const int kMaxCodeLength = 15;
+
+// Builds the tree into the arena and returns the root index. Every internal
+// node is added after its children, so parents always have higher indices.
+int buildHuffmanTree(const Histogram& freq, NodeArena& arena) {
+    arena.clear();
+    std::priority_queue<int, std::vector<int>, compare> pq(compare{&arena});
+    for (int s = 0; s < 256; s++) {
+        if (freq[s]) pq.push(arena.add(static_cast<unsigned char>(s), freq[s], -1, -1));
+    }
+
+    while (pq.size() != 1) {
+        int left = pq.top(); pq.pop();
+        int right = pq.top(); pq.pop();
+
+        uint64_t sum = arena.nodes[left].freq + arena.nodes[right].freq;
+        pq.push(arena.add('\0', sum, left, right));
+    }
+
+    return pq.top();
+}
+
+// Optimal code lengths bounded by maxLength, computed with package-merge.
+// Level 1 holds the leaves sorted by weight; every further level merges the
+// leaves with pairs ("packages") of the previous level. The first 2n-2 items of
+// the last level are selected and each leaf met while unrolling the packages
+// back down adds one bit to that symbol's length.
+// Works on any alphabet size; the extended pair alphabet uses it directly.
+std::vector<uint8_t> packageMerge(const uint64_t* freq, size_t symbols, int maxLength) {
+    struct Item {
+        uint64_t weight;
+        int symbol; // -1 for a package
+    };
+
+    std::vector<Item> leaves;
+    for (size_t s = 0; s < symbols; s++) {
+        if (freq[s]) leaves.push_back({freq[s], static_cast<int>(s)});
+    }
+    std::stable_sort(leaves.begin(), leaves.end(), [](const Item& a, const Item& b) {
+        return a.weight < b.weight;
+    });
+
+    std::vector<std::vector<Item>> levels(maxLength);
+    levels[0] = leaves;
+    for (int l = 1; l < maxLength; l++) {
+        const std::vector<Item>& prev = levels[l - 1];
+        std::vector<Item> packages;
+        for (size_t i = 0; i + 1 < prev.size(); i += 2) {
+            packages.push_back({prev[i].weight + prev[i + 1].weight, -1});
+        }
+        std::vector<Item>& level = levels[l];
+        level.resize(leaves.size() + packages.size());
+        std::merge(leaves.begin(), leaves.end(), packages.begin(), packages.end(), level.begin(),
+                   [](const Item& a, const Item& b) { return a.weight < b.weight; });
+    }
+
+    std::vector<uint8_t> lengths(symbols, 0);
+    size_t selected = 2 * leaves.size() - 2;
+    for (int l = maxLength - 1; l >= 0; l--) {
+        size_t packages = 0;
+        for (size_t i = 0; i < selected; i++) {
+            const Item& item = levels[l][i];
+            if (item.symbol < 0) {
+                packages++;
+            } else {
+                lengths[item.symbol]++;
+            }
+        }
+        selected = 2 * packages;
+    }
+    return lengths;
+}
+
+CodeLengths packageMergeCodeLengths(const Histogram& freq, int maxLength) {
+    std::vector<uint8_t> merged = packageMerge(freq.data(), freq.size(), maxLength);
+    CodeLengths lengths;
+    std::copy(merged.begin(), merged.end(), lengths.begin());
+    return lengths;
+}
+
+// Huffman code lengths limited to maxLength bits. The tree gives the optimal
+// lengths directly; package-merge is only needed when the tree is too deep.
+CodeLengths buildCodeLengths(const Histogram& freq, int maxLength) {
+    CodeLengths lengths{};
+    int used = 0;
+    for (int s = 0; s < 256; s++) {
+        if (freq[s]) used++;
+    }
+    if (used == 0) return lengths;
+    if (used == 1) {
+        // A lone symbol still needs a 1-bit code so the decoder can count it
+        for (int s = 0; s < 256; s++) {
+            if (freq[s]) lengths[s] = 1;
+        }
+        return lengths;
+    }
+
+    NodeArena arena;
+    int root = buildHuffmanTree(freq, arena);
+
+    // Walk from the root down through decreasing indices: a node's depth is
+    // always known before its children are reached
+    int depth[511];
+    depth[root] = 0;
+    int deepest = 0;
+    for (int i = root; i >= 0; i--) {
+        const Node& node = arena.nodes[i];
+        if (node.left < 0) {
+            lengths[node.ch] = static_cast<uint8_t>(std::min(depth[i], 255));
+            deepest = std::max(deepest, depth[i]);
+        } else {
+            depth[node.left] = depth[i] + 1;
+            depth[node.right] = depth[i] + 1;
+        }
+    }
+
+    if (deepest > maxLength) {
+        lengths = packageMergeCodeLengths(freq, maxLength);
+    }
+    return lengths;
+}
+
+struct HuffmanCode {
+    uint32_t code;
+    uint32_t length;
+};
+
+typedef std::array<HuffmanCode, 256> CodeTable;
+
+// Assigns canonical codes (DEFLATE order): shorter codes first, ties by symbol
+// value, so the decoder can rebuild them from the lengths alone.
+CodeTable buildCanonicalCode(const CodeLengths& lengths) {
+    int lengthCount[kMaxCodeLength + 1] = {};
+    for (int s = 0; s < 256; s++) {
+        lengthCount[lengths[s]]++;
+    }
+    lengthCount[0] = 0;
+
+    uint32_t nextCode[kMaxCodeLength + 2] = {};
+    uint32_t code = 0;
+    for (int len = 1; len <= kMaxCodeLength; len++) {
+        code = (code + lengthCount[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+
+    CodeTable table{};
+    for (int s = 0; s < 256; s++) {
+        int len = lengths[s];
+        if (len == 0) continue;
+        table[s].code = nextCode[len]++;
+        table[s].length = len;
+    }
+    return table;
+}
+
+// Writes a 64-bit word as 8 big-endian bytes so the stream can be read MSB-first.
+void storeBigEndian64(unsigned char* out, uint64_t word) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = static_cast<unsigned char>(word);
+        word >>= 8;
+    }
+}
+
+// Packs Huffman codes MSB-first into 64-bit words. Bits above the pending
+// count in `acc` are never read: they are shifted out when the word is flushed.
+struct BitWriter {
+    std::vector<unsigned char> bytes;
+    size_t used = 0;
+    uint64_t acc = 0;
+    int freeBits = 64;
+
+    void reserve(size_t size) {
+        bytes.resize(size + 8);
+    }
+
+    void put(uint64_t code, int len) {
+        if (len < freeBits) {
+            acc = (acc << len) | code;
+            freeBits -= len;
+            return;
+        }
+        int spill = len - freeBits;
+        flushWord((acc << freeBits) | (code >> spill));
+        acc = code;
+        freeBits = 64 - spill;
+    }
+
+    void flushWord(uint64_t word) {
+        if (used + 8 > bytes.size()) {
+            bytes.resize(std::max<size_t>(bytes.size() * 2, 64));
+        }
+        storeBigEndian64(&bytes[used], word);
+        used += 8;
+    }
+
+    // Appends raw bytes; only valid before any bits have been put.
+    void putBytes(const unsigned char* data, size_t size) {
+        if (used + size + 8 > bytes.size()) {
+            bytes.resize(used + size + 8);
+        }
+        std::memcpy(&bytes[used], data, size);
+        used += size;
+    }
+
+    // Emits the pending bits zero-padded to a whole byte and trims the buffer.
+    void finish() {
+        int pending = 64 - freeBits;
+        if (pending > 0) {
+            flushWord(acc << freeBits);
+            used -= 8 - (pending + 7) / 8;
+        }
+        bytes.resize(used);
+        acc = 0;
+        freeBits = 64;
+    }
+};
+
+void encodeInto(BitWriter& writer, const unsigned char* p, size_t size, const CodeTable& table) {
+    size_t i = 0;
+    // Four codes of at most kMaxCodeLength bits are joined into one put of <= 60 bits
+    for (; i + 4 <= size; i += 4) {
+        const HuffmanCode& a = table[p[i]];
+        const HuffmanCode& b = table[p[i + 1]];
+        const HuffmanCode& c = table[p[i + 2]];
+        const HuffmanCode& d = table[p[i + 3]];
+        uint64_t bits = a.code;
+        bits = (bits << b.length) | b.code;
+        bits = (bits << c.length) | c.code;
+        bits = (bits << d.length) | d.code;
+        writer.put(bits, a.length + b.length + c.length + d.length);
+    }
+    for (; i < size; i++) {
+        writer.put(table[p[i]].code, table[p[i]].length);
+    }
+}
+
+std::vector<unsigned char> encode(const unsigned char* p, size_t size, const CodeTable& table) {
+    BitWriter writer;
+    // Huffman output rarely exceeds the input size; the writer grows if it does
+    writer.reserve(size);
+    encodeInto(writer, p, size, table);
+    writer.finish();
+    return std::move(writer.bytes);
+}
+
+// Bytes of pixel data per chunk. Chunks are coded and deflated independently
+// so both programs can spread them across threads.
+const size_t kDefaultChunkSize = 1 << 20;
+const size_t kMinChunkSize = 4096;
+
+typedef std::function<std::vector<unsigned char>(const unsigned char*, size_t)> ChunkEncoder;
+
+void appendU32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Deflates an encoded chunk with zlib, as the whole buffer was before chunking.
+std::vector<unsigned char> deflateChunk(const std::vector<unsigned char>& encoded) {
+    uLongf compressedSize = compressBound(encoded.size());
+    std::vector<unsigned char> compressed(compressedSize);
+    compress(compressed.data(), &compressedSize, encoded.data(), encoded.size());
+    compressed.resize(compressedSize);
+    return compressed;
+}
+
+// Splits data into chunkSize pieces and runs encodeChunk on each one in
+// parallel. Layout: chunk size, chunk count, chunkCount + 1 offsets relative
+// to the first payload byte, then the payloads back to back.
+std::string packChunks(const std::vector<unsigned char>& data, size_t chunkSize, const ChunkEncoder& encodeChunk) {
+    size_t chunkCount = (data.size() + chunkSize - 1) / chunkSize;
+    std::vector<std::vector<unsigned char>> chunks(chunkCount);
+    parallelFor(chunkCount, [&](size_t i) {
+        size_t begin = i * chunkSize;
+        chunks[i] = encodeChunk(data.data() + begin, std::min(chunkSize, data.size() - begin));
+    });
+
+    std::string packed;
+    appendU32(packed, static_cast<uint32_t>(chunkSize));
+    appendU32(packed, static_cast<uint32_t>(chunkCount));
+    uint32_t offset = 0;
+    appendU32(packed, offset);
+    for (const std::vector<unsigned char>& chunk : chunks) {
+        offset += static_cast<uint32_t>(chunk.size());
+        appendU32(packed, offset);
+    }
+    for (const std::vector<unsigned char>& chunk : chunks) {
+        packed.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    }
+    return packed;
+}
+
+// Multi-table mode (bzip2-style): every kTableGroupSize bytes of a chunk pick
+// the cheapest of up to kMaxTables code tables. Selectors are one byte per
+// group and are stored at the start of each chunk, before the packed bits.
+const int kMaxTables = 6;
+const size_t kTableGroupSize = 1024;
+const int kTableIterations = 4;
+
+struct TableGroup {
+    size_t begin;
+    size_t size;
+};
+
+// Groups never straddle a chunk boundary, so chunk i owns the selectors
+// [i * groupsPerChunk, ...) and can be coded on its own.
+std::vector<TableGroup> splitTableGroups(size_t dataSize, size_t chunkSize) {
+    std::vector<TableGroup> groups;
+    for (size_t chunk = 0; chunk < dataSize; chunk += chunkSize) {
+        size_t chunkEnd = std::min(dataSize, chunk + chunkSize);
+        for (size_t begin = chunk; begin < chunkEnd; begin += kTableGroupSize) {
+            groups.push_back({begin, std::min(kTableGroupSize, chunkEnd - begin)});
+        }
+    }
+    return groups;
+}
+
+// Picks the cheapest table for every group. Lengths of four tables share a
+// uint64_t in 16-bit lanes, so each byte costs one add per word: one for up
+// to four tables, two for up to eight. A group costs at most 1024 * 15 bits,
+// which fits in a lane.
+void selectTables(const std::vector<unsigned char>& data, const std::vector<TableGroup>& groups, const std::vector<CodeLengths>& lengths, std::vector<unsigned char>& selectors) {
+    uint64_t packed[2][256] = {};
+    for (size_t t = 0; t < lengths.size(); t++) {
+        for (int s = 0; s < 256; s++) {
+            packed[t / 4][s] |= static_cast<uint64_t>(lengths[t][s]) << (16 * (t % 4));
+        }
+    }
+
+    const size_t batch = 1024;
+    parallelFor((groups.size() + batch - 1) / batch, [&](size_t b) {
+        size_t end = std::min(groups.size(), (b + 1) * batch);
+        for (size_t g = b * batch; g < end; g++) {
+            const unsigned char* p = data.data() + groups[g].begin;
+            uint64_t cost[2] = {0, 0};
+            if (lengths.size() <= 4) {
+                for (size_t i = 0; i < groups[g].size; i++) cost[0] += packed[0][p[i]];
+            } else {
+                for (size_t i = 0; i < groups[g].size; i++) {
+                    cost[0] += packed[0][p[i]];
+                    cost[1] += packed[1][p[i]];
+                }
+            }
+            unsigned char best = 0;
+            uint64_t bestCost = UINT64_MAX;
+            for (size_t t = 0; t < lengths.size(); t++) {
+                uint64_t c = (cost[t / 4] >> (16 * (t % 4))) & 0xFFFF;
+                if (c < bestCost) {
+                    bestCost = c;
+                    best = static_cast<unsigned char>(t);
+                }
+            }
+            selectors[g] = best;
+        }
+    });
+}
+
+// Trains tableCount code tables: groups start split into quantiles of their
+// mean byte value, then each round rebuilds every table from the groups that
+// chose it and lets every group choose again. Each table keeps a code for
+// every byte present in the image so any group can use any table.
+std::vector<CodeLengths> trainCodeTables(const std::vector<unsigned char>& data, const std::vector<TableGroup>& groups, const Histogram& freq, int tableCount, int maxCodeLength, std::vector<unsigned char>& selectors) {
+    selectors.assign(groups.size(), 0);
+    std::vector<std::pair<uint64_t, size_t>> means(groups.size());
+    parallelFor(groups.size(), [&](size_t g) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < groups[g].size; i++) sum += data[groups[g].begin + i];
+        means[g] = {sum * kTableGroupSize / groups[g].size, g};
+    });
+    std::sort(means.begin(), means.end());
+    for (size_t i = 0; i < means.size(); i++) {
+        selectors[means[i].second] = static_cast<unsigned char>(i * tableCount / means.size());
+    }
+
+    std::vector<CodeLengths> lengths(tableCount);
+    for (int iteration = 0; iteration < kTableIterations; iteration++) {
+        std::vector<Histogram> tableFreq(tableCount, Histogram{});
+        for (size_t g = 0; g < groups.size(); g++) {
+            Histogram& h = tableFreq[selectors[g]];
+            const unsigned char* p = data.data() + groups[g].begin;
+            for (size_t i = 0; i < groups[g].size; i++) h[p[i]]++;
+        }
+        for (int t = 0; t < tableCount; t++) {
+            for (int s = 0; s < 256; s++) {
+                if (freq[s]) tableFreq[t][s]++;
+            }
+            lengths[t] = buildCodeLengths(tableFreq[t], maxCodeLength);
+        }
+        selectTables(data, groups, lengths, selectors);
+    }
+    return lengths;
+}
+
+// Chunk payload in multi-table mode: the chunk's selectors, then its groups
+// coded with the table each one selected.
+std::vector<unsigned char> encodeWithSelectors(const unsigned char* chunk, size_t size, const unsigned char* selectors, const std::vector<CodeTable>& tables) {
+    size_t groupCount = (size + kTableGroupSize - 1) / kTableGroupSize;
+    BitWriter writer;
+    writer.reserve(groupCount + size);
+    writer.putBytes(selectors, groupCount);
+    for (size_t g = 0; g < groupCount; g++) {
+        size_t begin = g * kTableGroupSize;
+        encodeInto(writer, chunk + begin, std::min(kTableGroupSize, size - begin), tables[selectors[g]]);
+    }
+    writer.finish();
+    return std::move(writer.bytes);
+}
+
+// LOCO-I (JPEG-LS, ITU-T T.87) lossless coding of 8-bit samples: median edge
+// detector prediction, 365 gradient contexts with bias correction, adaptive
+// Golomb-Rice residuals and a run mode for flat areas. Each chunk is a stripe
+// of whole rows coded from fresh state, one component after another.
+const int kLocoRange = 256;
+const int kLocoQbpp = 8;
+const int kLocoLimit = 32;
+const int kLocoReset = 64;
+const int kLocoT1 = 3;
+const int kLocoT2 = 7;
+const int kLocoT3 = 21;
+const int kLocoContexts = 365;
+const int kLocoJ[32] = {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                        4, 4, 5, 5, 6, 6, 7, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+struct LocoContext {
+    int A = 4;
+    int B = 0;
+    int C = 0;
+    int N = 1;
+};
+
+struct LocoRunContext {
+    int A = 4;
+    int N = 1;
+    int Nn = 0;
+};
+
+struct LocoState {
+    LocoContext regular[kLocoContexts];
+    LocoRunContext run[2];
+    int runIndex = 0;
+};
+
+inline int locoQuantize(int d) {
+    if (d <= -kLocoT3) return -4;
+    if (d <= -kLocoT2) return -3;
+    if (d <= -kLocoT1) return -2;
+    if (d < 0) return -1;
+    if (d == 0) return 0;
+    if (d < kLocoT1) return 1;
+    if (d < kLocoT2) return 2;
+    if (d < kLocoT3) return 3;
+    return 4;
+}
+
+inline int locoMedPredict(int a, int b, int c) {
+    if (c >= std::max(a, b)) return std::min(a, b);
+    if (c <= std::min(a, b)) return std::max(a, b);
+    return a + b - c;
+}
+
+// Wraps an error into [-128, 127] so residuals stay within 8 bits.
+inline int locoReduce(int e) {
+    if (e < -kLocoRange / 2) return e + kLocoRange;
+    if (e >= kLocoRange / 2) return e - kLocoRange;
+    return e;
+}
+
+// Limited-length Golomb code: unary quotient then k low bits, or an escape
+// of limit - qbpp - 1 zeros followed by the raw value when the quotient is large.
+void locoPutGolomb(BitWriter& writer, int k, int mapped, int limit) {
+    int high = mapped >> k;
+    if (high < limit - kLocoQbpp - 1) {
+        writer.put(1, high + 1);
+        if (k) writer.put(mapped & ((1 << k) - 1), k);
+    } else {
+        writer.put(1, limit - kLocoQbpp);
+        writer.put((mapped - 1) & ((1 << kLocoQbpp) - 1), kLocoQbpp);
+    }
+}
+
+void locoUpdate(LocoContext& ctx, int err) {
+    int a = ctx.A + std::abs(err);
+    int b = ctx.B + err;
+    int n = ctx.N;
+    if (n == kLocoReset) {
+        a >>= 1;
+        b = b >= 0 ? b >> 1 : -((1 - b) >> 1);
+        n >>= 1;
+    }
+    ctx.A = a;
+    n++;
+    ctx.N = n;
+    if (b + n <= 0) {
+        b += n;
+        if (b <= -n) b = -n + 1;
+        if (ctx.C > -128) ctx.C--;
+    } else if (b > 0) {
+        b -= n;
+        if (b > 0) b = 0;
+        if (ctx.C < 127) ctx.C++;
+    }
+    ctx.B = b;
+}
+
+void locoEncodeRegular(BitWriter& writer, LocoState& state, int q, int x, int a, int b, int c) {
+    int sign = 1;
+    if (q < 0) {
+        q = -q;
+        sign = -1;
+    }
+    LocoContext& ctx = state.regular[q];
+    int px = std::min(255, std::max(0, locoMedPredict(a, b, c) + sign * ctx.C));
+    int err = locoReduce(sign * (x - px));
+
+    int k = 0;
+    while ((ctx.N << k) < ctx.A) k++;
+    int e = (k == 0 && 2 * ctx.B + ctx.N - 1 < 0) ? -err - 1 : err;
+    locoPutGolomb(writer, k, e >= 0 ? 2 * e : -2 * e - 1, kLocoLimit);
+    locoUpdate(ctx, err);
+}
+
+// Codes the sample that ends a run; its context depends on whether the
+// neighbours above and to the left are equal.
+void locoEncodeInterruption(BitWriter& writer, LocoState& state, int x, int ra, int rb) {
+    int type = ra == rb ? 1 : 0;
+    LocoRunContext& ctx = state.run[type];
+    int err = type ? locoReduce(x - ra) : locoReduce((x - rb) * (rb >= ra ? 1 : -1));
+
+    int temp = ctx.A + (ctx.N >> 1) * type;
+    int k = 0;
+    for (int n = ctx.N; n < temp; n <<= 1) k++;
+    bool map = (k == 0 && err > 0 && 2 * ctx.Nn < ctx.N) || (err < 0 && (2 * ctx.Nn >= ctx.N || k != 0));
+    int mapped = 2 * std::abs(err) - type - (map ? 1 : 0);
+    locoPutGolomb(writer, k, mapped, kLocoLimit - kLocoJ[state.runIndex] - 1);
+
+    if (err < 0) ctx.Nn++;
+    ctx.A += (mapped + 1 - type) >> 1;
+    if (ctx.N == kLocoReset) {
+        ctx.A >>= 1;
+        ctx.N >>= 1;
+        ctx.Nn >>= 1;
+    }
+    ctx.N++;
+}
+
+// Codes the run of samples equal to the left neighbour starting at x and, if
+// the run stops before the end of the row, the interrupting sample. Lines are
+// padded by one sample on each side. Returns the number of samples consumed.
+int locoEncodeRun(BitWriter& writer, LocoState& state, const int* cur, const int* prev, int x, int width) {
+    int ra = cur[x];
+    int run = 0;
+    while (x + run < width && cur[x + run + 1] == ra) run++;
+
+    int remaining = run;
+    while (remaining >= (1 << kLocoJ[state.runIndex])) {
+        writer.put(1, 1);
+        remaining -= 1 << kLocoJ[state.runIndex];
+        if (state.runIndex < 31) state.runIndex++;
+    }
+    if (x + run == width) {
+        if (remaining > 0) writer.put(1, 1);
+        return run;
+    }
+
+    // A zero bit, then the leftover run length in J[runIndex] bits
+    writer.put(remaining, kLocoJ[state.runIndex] + 1);
+    int end = x + run;
+    locoEncodeInterruption(writer, state, cur[end + 1], ra, prev[end + 1]);
+    if (state.runIndex > 0) state.runIndex--;
+    return run + 1;
+}
+
+// Codes one stripe of whole rows. Sample x of a line sits at index x + 1; the
+// left pad repeats the first sample above and the right pad of the previous
+// line repeats its last sample, as in T.87.
+std::vector<unsigned char> encodeLocoStripe(const unsigned char* pixels, size_t size, int width, int channels) {
+    size_t rowBytes = static_cast<size_t>(width) * channels;
+    int rows = static_cast<int>(size / rowBytes);
+    BitWriter writer;
+    writer.reserve(size / 2);
+
+    for (int comp = 0; comp < channels; comp++) {
+        LocoState state;
+        std::vector<int> prevLine(width + 2, 0), curLine(width + 2, 0);
+        for (int y = 0; y < rows; y++) {
+            const unsigned char* row = pixels + y * rowBytes + comp;
+            for (int x = 0; x < width; x++) curLine[x + 1] = row[x * channels];
+            curLine[0] = prevLine[1];
+            prevLine[width + 1] = prevLine[width];
+            const int* cur = curLine.data();
+            const int* prev = prevLine.data();
+
+            int x = 0;
+            while (x < width) {
+                int a = cur[x], b = prev[x + 1], c = prev[x], d = prev[x + 2];
+                int q = (locoQuantize(d - b) * 9 + locoQuantize(b - c)) * 9 + locoQuantize(c - a);
+                if (q == 0) {
+                    x += locoEncodeRun(writer, state, cur, prev, x, width);
+                } else {
+                    locoEncodeRegular(writer, state, q, cur[x + 1], a, b, c);
+                    x++;
+                }
+            }
+            std::swap(prevLine, curLine);
+        }
+    }
+
+    writer.finish();
+    return std::move(writer.bytes);
+}
+
+// Interleaved rANS in the byte-wise variant of ryg_rans: 32-bit states kept
+// in [2^23, 2^31) and renormalized a byte at a time. Symbols go round-robin
+// to kRansStates states so the decoder's dependency chains overlap.
+// Frequencies are normalized to sum to 2^kRansScaleBits.
+const int kRansScaleBits = 14;
+const uint32_t kRansLowerBound = 1u << 23;
+const int kRansStates = 4;
+
+typedef std::array<uint32_t, 256> NormalizedCounts;
+
+// Scales the histogram to 2^scaleBits keeping every present symbol at >= 1,
+// then moves the rounding error onto the most frequent symbols.
+NormalizedCounts normalizeFrequencies(const Histogram& freq, int scaleBits) {
+    NormalizedCounts norm{};
+    uint64_t total = 0;
+    for (int s = 0; s < 256; s++) total += freq[s];
+    if (total == 0) return norm;
+
+    uint32_t target = 1u << scaleBits;
+    int64_t sum = 0;
+    for (int s = 0; s < 256; s++) {
+        if (!freq[s]) continue;
+        norm[s] = std::max<uint32_t>(1, static_cast<uint32_t>((freq[s] * target + total / 2) / total));
+        sum += norm[s];
+    }
+    while (sum != target) {
+        int largest = 0;
+        for (int s = 1; s < 256; s++) {
+            if (norm[s] > norm[largest]) largest = s;
+        }
+        if (sum < target) {
+            norm[largest] += static_cast<uint32_t>(target - sum);
+            sum = target;
+        } else {
+            // Take at most down to 1 from the largest symbol and go again
+            uint32_t take = static_cast<uint32_t>(std::min<int64_t>(sum - target, norm[largest] - 1));
+            norm[largest] -= take;
+            sum -= take;
+        }
+    }
+    return norm;
+}
+
+// Division-free encoder entry: x / freq is computed as a multiply by a
+// rounded reciprocal and a shift (ryg_rans RansEncSymbol).
+struct RansEncSymbol {
+    uint32_t xMax;
+    uint32_t rcpFreq;
+    uint32_t bias;
+    uint32_t cmplFreq;
+    uint32_t rcpShift;
+};
+
+typedef std::array<RansEncSymbol, 256> RansEncTable;
+
+RansEncTable buildRansEncTable(const NormalizedCounts& norm) {
+    RansEncTable table{};
+    uint32_t start = 0;
+    for (int s = 0; s < 256; s++) {
+        uint32_t freq = norm[s];
+        if (freq == 0) continue;
+        RansEncSymbol& sym = table[s];
+        sym.xMax = ((kRansLowerBound >> kRansScaleBits) << 8) * freq;
+        sym.cmplFreq = (1u << kRansScaleBits) - freq;
+        if (freq < 2) {
+            sym.rcpFreq = ~0u;
+            sym.rcpShift = 0;
+            sym.bias = start + (1u << kRansScaleBits) - 1;
+        } else {
+            uint32_t shift = 0;
+            while (freq > (1u << shift)) shift++;
+            sym.rcpFreq = static_cast<uint32_t>(((1ull << (shift + 31)) + freq - 1) / freq);
+            sym.rcpShift = shift - 1;
+            sym.bias = start;
+        }
+        start += freq;
+    }
+    return table;
+}
+
+inline void ransEncPut(uint32_t& x, unsigned char*& ptr, const RansEncSymbol& sym) {
+    while (x >= sym.xMax) {
+        *--ptr = static_cast<unsigned char>(x);
+        x >>= 8;
+    }
+    uint32_t q = static_cast<uint32_t>((static_cast<uint64_t>(x) * sym.rcpFreq) >> 32) >> sym.rcpShift;
+    x += sym.bias + q * sym.cmplFreq;
+}
+
+// rANS is last-in first-out, so the chunk is coded back to front into the end
+// of a buffer; symbol i uses state i % kRansStates. The final states are
+// flushed last-to-first so the decoder reads state 0 first.
+std::vector<unsigned char> encodeRans(const unsigned char* data, size_t size, const RansEncTable& table) {
+    // A symbol emits at most two bytes at 14 scale bits
+    std::vector<unsigned char> buffer(2 * size + 4 * kRansStates);
+    unsigned char* end = buffer.data() + buffer.size();
+    unsigned char* ptr = end;
+
+    uint32_t state[kRansStates];
+    for (int s = 0; s < kRansStates; s++) state[s] = kRansLowerBound;
+
+    size_t i = size;
+    while (i % kRansStates != 0) {
+        i--;
+        ransEncPut(state[i % kRansStates], ptr, table[data[i]]);
+    }
+    while (i > 0) {
+        i -= kRansStates;
+        ransEncPut(state[3], ptr, table[data[i + 3]]);
+        ransEncPut(state[2], ptr, table[data[i + 2]]);
+        ransEncPut(state[1], ptr, table[data[i + 1]]);
+        ransEncPut(state[0], ptr, table[data[i]]);
+    }
+
+    for (int s = kRansStates - 1; s >= 0; s--) {
+        ptr -= 4;
+        ptr[0] = static_cast<unsigned char>(state[s]);
+        ptr[1] = static_cast<unsigned char>(state[s] >> 8);
+        ptr[2] = static_cast<unsigned char>(state[s] >> 16);
+        ptr[3] = static_cast<unsigned char>(state[s] >> 24);
+    }
+    return std::vector<unsigned char>(ptr, end);
+}
+
+// tANS in the FSE (finite state entropy) form: the normalized counts are
+// spread over a 2^kFseTableLog state table, and each symbol costs one table
+// lookup plus a few raw bits. Two states alternate between symbols. The
+// chunk is coded back to front through a forward BitWriter and the decoder
+// reads the bits backwards from an end marker.
+const int kFseTableLog = 12;
+
+struct FseSymbolTransform {
+    int32_t deltaFindState;
+    uint32_t deltaNbBits;
+};
+
+struct FseEncTable {
+    int tableLog;
+    std::vector<uint16_t> stateTable;
+    std::array<FseSymbolTransform, 256> symbolTT;
+};
+
+inline int highBit(uint32_t value) {
+    int bit = 0;
+    while (value >>= 1) bit++;
+    return bit;
+}
+
+// FSE's spread: a fixed odd step scatters each symbol's states over the table.
+std::vector<unsigned char> fseSpreadSymbols(const NormalizedCounts& norm, int tableLog) {
+    uint32_t tableSize = 1u << tableLog;
+    uint32_t mask = tableSize - 1;
+    uint32_t step = (tableSize >> 1) + (tableSize >> 3) + 3;
+    std::vector<unsigned char> tableSymbol(tableSize);
+    uint32_t pos = 0;
+    for (int s = 0; s < 256; s++) {
+        for (uint32_t i = 0; i < norm[s]; i++) {
+            tableSymbol[pos] = static_cast<unsigned char>(s);
+            pos = (pos + step) & mask;
+        }
+    }
+    return tableSymbol;
+}
+
+FseEncTable buildFseEncTable(const NormalizedCounts& norm, int tableLog) {
+    uint32_t tableSize = 1u << tableLog;
+    std::vector<unsigned char> tableSymbol = fseSpreadSymbols(norm, tableLog);
+
+    FseEncTable table;
+    table.tableLog = tableLog;
+    table.stateTable.resize(tableSize);
+    uint32_t cumul[257] = {};
+    for (int s = 0; s < 256; s++) cumul[s + 1] = cumul[s] + norm[s];
+    for (uint32_t u = 0; u < tableSize; u++) {
+        table.stateTable[cumul[tableSymbol[u]]++] = static_cast<uint16_t>(tableSize + u);
+    }
+
+    int32_t total = 0;
+    for (int s = 0; s < 256; s++) {
+        FseSymbolTransform& tt = table.symbolTT[s];
+        uint32_t count = norm[s];
+        if (count == 0) {
+            tt = FseSymbolTransform{0, 0};
+        } else if (count == 1) {
+            tt.deltaNbBits = (static_cast<uint32_t>(tableLog) << 16) - tableSize;
+            tt.deltaFindState = total - 1;
+            total++;
+        } else {
+            uint32_t maxBitsOut = tableLog - highBit(count - 1);
+            uint32_t minStatePlus = count << maxBitsOut;
+            tt.deltaNbBits = (maxBitsOut << 16) - minStatePlus;
+            tt.deltaFindState = total - static_cast<int32_t>(count);
+            total += count;
+        }
+    }
+    return table;
+}
+
+inline void fseEncodeSymbol(BitWriter& writer, uint32_t& state, const FseEncTable& table, unsigned char symbol) {
+    const FseSymbolTransform& tt = table.symbolTT[symbol];
+    uint32_t nbBits = (state + tt.deltaNbBits) >> 16;
+    writer.put(state & ((1u << nbBits) - 1), nbBits);
+    state = table.stateTable[(state >> nbBits) + tt.deltaFindState];
+}
+
+std::vector<unsigned char> encodeFse(const unsigned char* data, size_t size, const FseEncTable& table) {
+    uint32_t tableSize = 1u << table.tableLog;
+    BitWriter writer;
+    writer.reserve(size);
+
+    // Symbol i uses state i % 2; both start from an arbitrary valid state
+    uint32_t state[2] = {tableSize, tableSize};
+    size_t i = size;
+    if (i % 2) {
+        i--;
+        fseEncodeSymbol(writer, state[0], table, data[i]);
+    }
+    while (i > 0) {
+        i -= 2;
+        fseEncodeSymbol(writer, state[1], table, data[i + 1]);
+        fseEncodeSymbol(writer, state[0], table, data[i]);
+    }
+
+    writer.put(state[1] - tableSize, table.tableLog);
+    writer.put(state[0] - tableSize, table.tableLog);
+    writer.put(1, 1); // end marker: the decoder starts right below the last set bit
+    writer.finish();
+    return std::move(writer.bytes);
+}
+
+// Compact count header: the table log in 4 bits, then each count in just
+// enough bits for the probability still unassigned, stopping once it runs
+// out. A zero count is followed by 2-bit repeat codes for further zeros.
+void writeFseCounts(const NormalizedCounts& norm, int tableLog, std::string& out) {
+    BitWriter writer;
+    writer.put(tableLog, 4);
+    uint32_t remaining = 1u << tableLog;
+    int s = 0;
+    while (remaining > 0 && s < 256) {
+        writer.put(norm[s], highBit(remaining) + 1);
+        remaining -= norm[s];
+        if (norm[s++] == 0) {
+            int zeros = 0;
+            while (s + zeros < 256 && norm[s + zeros] == 0) zeros++;
+            s += zeros;
+            while (zeros >= 3) {
+                writer.put(3, 2);
+                zeros -= 3;
+            }
+            writer.put(zeros, 2);
+        }
+    }
+    writer.finish();
+    out.append(writer.bytes.begin(), writer.bytes.end());
+}
+
+// "max" mode: adaptive binary arithmetic coding of MED prediction residuals.
+// Each residual is folded to 0..255; a first decision says whether it is
+// zero, and a nonzero one then goes MSB first down a binary tree of adaptive
+// probabilities. Both are chosen by the local gradient activity and, after
+// the first component, by the size of the previous component's residual at
+// the same pixel; the zero decision also looks at whether the residual to
+// the left was zero, which is what makes flat areas and smooth gradients
+// nearly free. Chunks are stripes of whole rows coded plane by plane from
+// fresh models, like LOCO-I.
+const int kArithActivityBuckets = 10;
+const int kArithComponentBuckets = 4;
+// Probabilities have 16 bits so a near-certain decision can cost well under
+// 0.01 bit. Each one is the mean of a fast and a slow estimate, which tracks
+// local changes without giving up the precision of the slow one.
+const int kArithProbBits = 16;
+const int kArithFastBits = 4;
+const int kArithSlowBits = 7;
+
+struct ArithProb {
+    uint16_t fast = 1 << (kArithProbBits - 1);
+    uint16_t slow = 1 << (kArithProbBits - 1);
+
+    uint32_t zero() const { return (static_cast<uint32_t>(fast) + slow) >> 1; }
+
+    void update(int bit) {
+        if (bit == 0) {
+            fast += ((1 << kArithProbBits) - fast) >> kArithFastBits;
+            slow += ((1 << kArithProbBits) - slow) >> kArithSlowBits;
+        } else {
+            fast -= fast >> kArithFastBits;
+            slow -= slow >> kArithSlowBits;
+        }
+    }
+};
+
+// LZMA-style carry-less range coder over 16-bit bit probabilities.
+struct RangeEncoder {
+    std::vector<unsigned char> bytes;
+    uint64_t low = 0;
+    uint32_t range = 0xFFFFFFFF;
+    unsigned char cache = 0;
+    uint64_t cacheSize = 1;
+
+    void encodeBit(ArithProb& prob, int bit) {
+        uint32_t bound = (range >> kArithProbBits) * prob.zero();
+        if (bit == 0) {
+            range = bound;
+        } else {
+            low += bound;
+            range -= bound;
+        }
+        prob.update(bit);
+        while (range < (1u << 24)) {
+            range <<= 8;
+            shiftLow();
+        }
+    }
+
+    void shiftLow() {
+        if (static_cast<uint32_t>(low) < 0xFF000000u || (low >> 32) != 0) {
+            unsigned char carry = static_cast<unsigned char>(low >> 32);
+            unsigned char temp = cache;
+            do {
+                bytes.push_back(static_cast<unsigned char>(temp + carry));
+                temp = 0xFF;
+            } while (--cacheSize != 0);
+            cache = static_cast<unsigned char>(low >> 24);
+        }
+        cacheSize++;
+        low = (low & 0x00FFFFFF) << 8;
+    }
+
+    void finish() {
+        for (int i = 0; i < 5; i++) shiftLow();
+    }
+};
+
+struct ArithModel {
+    ArithProb zero[2][kArithComponentBuckets][kArithActivityBuckets];
+    ArithProb tree[kArithComponentBuckets][kArithActivityBuckets][256];
+};
+
+inline int arithActivityBucket(int a, int b, int c, int d) {
+    int activity = std::abs(d - b) + std::abs(b - c) + std::abs(c - a);
+    return std::min(kArithActivityBuckets - 1, highBit(static_cast<uint32_t>(activity) + 1));
+}
+
+inline int arithComponentBucket(unsigned char previousResidual) {
+    return std::min(kArithComponentBuckets - 1, highBit(static_cast<uint32_t>(previousResidual) + 1) / 2);
+}
+
+std::vector<unsigned char> encodeArithStripe(const unsigned char* pixels, size_t size, int width, int channels) {
+    size_t rowBytes = static_cast<size_t>(width) * channels;
+    int rows = static_cast<int>(size / rowBytes);
+    RangeEncoder encoder;
+    encoder.bytes.reserve(size / 2);
+    std::unique_ptr<ArithModel> model(new ArithModel());
+    // Folded residual of the previous component for every pixel of the stripe
+    std::vector<unsigned char> previousResidual(static_cast<size_t>(width) * rows, 0);
+
+    for (int comp = 0; comp < channels; comp++) {
+        *model = ArithModel();
+        std::vector<int> prevLine(width + 2, 0), curLine(width + 2, 0);
+        for (int y = 0; y < rows; y++) {
+            const unsigned char* row = pixels + y * rowBytes + comp;
+            for (int x = 0; x < width; x++) curLine[x + 1] = row[x * channels];
+            curLine[0] = prevLine[1];
+            prevLine[width + 1] = prevLine[width];
+
+            int leftFolded = 0;
+            for (int x = 0; x < width; x++) {
+                int a = curLine[x], b = prevLine[x + 1], c = prevLine[x], d = prevLine[x + 2];
+                int err = locoReduce(curLine[x + 1] - locoMedPredict(a, b, c));
+                int folded = err >= 0 ? 2 * err : -2 * err - 1;
+
+                unsigned char& other = previousResidual[static_cast<size_t>(y) * width + x];
+                int component = comp > 0 ? arithComponentBucket(other) : 0;
+                int activity = arithActivityBucket(a, b, c, d);
+                encoder.encodeBit(model->zero[leftFolded != 0][component][activity], folded != 0);
+                if (folded != 0) {
+                    ArithProb* probs = model->tree[component][activity];
+                    int node = 1;
+                    for (int bit = 7; bit >= 0; bit--) {
+                        int value = ((folded - 1) >> bit) & 1;
+                        encoder.encodeBit(probs[node], value);
+                        node = node * 2 + value;
+                    }
+                }
+                other = static_cast<unsigned char>(folded);
+                leftFolded = folded;
+            }
+            std::swap(prevLine, curLine);
+        }
+    }
+
+    encoder.finish();
+    return std::move(encoder.bytes);
+}
+
+// Extended-alphabet mode: each byte pair is one of 65536 symbols, so nearly
+// constant background costs well under one bit per byte and the decoder emits
+// two bytes per lookup. Pairs start at even offsets; chunks are kept even and
+// an odd last byte is padded with a zero the decoder drops.
+const size_t kPairSymbols = 1 << 16;
+const int kPairMaxCodeLength = 20;
+
+std::vector<uint64_t> buildPairHistogram(const std::vector<unsigned char>& data) {
+    size_t slices = (data.size() + kHistogramSlice - 1) / kHistogramSlice;
+    std::vector<std::vector<uint64_t>> partial(slices);
+    parallelFor(slices, [&](size_t i) {
+        partial[i].assign(kPairSymbols, 0);
+        size_t begin = i * kHistogramSlice;
+        size_t end = std::min(data.size(), begin + kHistogramSlice);
+        size_t j = begin;
+        for (; j + 2 <= end; j += 2) partial[i][(data[j] << 8) | data[j + 1]]++;
+        if (j < end) partial[i][data[j] << 8]++;
+    });
+
+    std::vector<uint64_t> freq(kPairSymbols, 0);
+    for (const std::vector<uint64_t>& h : partial) {
+        for (size_t s = 0; s < kPairSymbols; s++) freq[s] += h[s];
+    }
+    return freq;
+}
+
+// Pair tables are always length-limited with package-merge: with tens of
+// thousands of symbols the plain tree is routinely deeper than the limit.
+std::vector<uint8_t> buildPairCodeLengths(const std::vector<uint64_t>& freq) {
+    size_t used = std::count_if(freq.begin(), freq.end(), [](uint64_t f) { return f != 0; });
+    if (used == 1) {
+        std::vector<uint8_t> lengths(kPairSymbols, 0);
+        lengths[std::find_if(freq.begin(), freq.end(), [](uint64_t f) { return f != 0; }) - freq.begin()] = 1;
+        return lengths;
+    }
+    return packageMerge(freq.data(), kPairSymbols, kPairMaxCodeLength);
+}
+
+// Same canonical order as buildCanonicalCode(), over the pair alphabet.
+std::vector<HuffmanCode> buildPairCanonicalCode(const std::vector<uint8_t>& lengths) {
+    int lengthCount[kPairMaxCodeLength + 1] = {};
+    for (uint8_t len : lengths) lengthCount[len]++;
+    lengthCount[0] = 0;
+
+    uint32_t nextCode[kPairMaxCodeLength + 2] = {};
+    uint32_t code = 0;
+    for (int len = 1; len <= kPairMaxCodeLength; len++) {
+        code = (code + lengthCount[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+
+    std::vector<HuffmanCode> table(kPairSymbols, HuffmanCode{0, 0});
+    for (size_t s = 0; s < kPairSymbols; s++) {
+        int len = lengths[s];
+        if (len == 0) continue;
+        table[s].code = nextCode[len]++;
+        table[s].length = len;
+    }
+    return table;
+}
+
+std::vector<unsigned char> encodePairs(const unsigned char* p, size_t size, const std::vector<HuffmanCode>& table) {
+    BitWriter writer;
+    writer.reserve(size);
+    size_t i = 0;
+    // Three codes of at most kPairMaxCodeLength bits fit one put of <= 60 bits
+    for (; i + 6 <= size; i += 6) {
+        const HuffmanCode& a = table[(p[i] << 8) | p[i + 1]];
+        const HuffmanCode& b = table[(p[i + 2] << 8) | p[i + 3]];
+        const HuffmanCode& c = table[(p[i + 4] << 8) | p[i + 5]];
+        uint64_t bits = a.code;
+        bits = (bits << b.length) | b.code;
+        bits = (bits << c.length) | c.code;
+        writer.put(bits, a.length + b.length + c.length);
+    }
+    for (; i < size; i += 2) {
+        const HuffmanCode& code = table[(p[i] << 8) | (i + 1 < size ? p[i + 1] : 0)];
+        writer.put(code.code, code.length);
+    }
+    writer.finish();
+    return std::move(writer.bytes);
+}
+
+// Block-sorting mode (bzip2-style): every chunk is one block that goes through
+// the Burrows-Wheeler transform, move-to-front and a zero-run coding before a
+// shared Huffman table. Blocks are sorted in parallel with SA-IS.
+//
+// SA-IS (Nong, Zhang and Chan) over an int string whose last symbol is a
+// unique 0 sentinel; alphabetSize bounds the symbols. The reduced problem is
+// stored inside SA itself, so the only extra memory is the type bits.
+void getBuckets(const int* s, int n, int alphabetSize, std::vector<int>& bucket, bool ends) {
+    bucket.assign(alphabetSize, 0);
+    for (int i = 0; i < n; i++) bucket[s[i]]++;
+    int sum = 0;
+    for (int c = 0; c < alphabetSize; c++) {
+        sum += bucket[c];
+        bucket[c] = ends ? sum : sum - bucket[c];
+    }
+}
+
+void induceSort(const int* s, int* sa, int n, int alphabetSize, const std::vector<bool>& sType, std::vector<int>& bucket) {
+    getBuckets(s, n, alphabetSize, bucket, false);
+    for (int i = 0; i < n; i++) {
+        int j = sa[i] - 1;
+        if (sa[i] > 0 && !sType[j]) sa[bucket[s[j]]++] = j;
+    }
+    getBuckets(s, n, alphabetSize, bucket, true);
+    for (int i = n - 1; i >= 0; i--) {
+        int j = sa[i] - 1;
+        if (sa[i] > 0 && sType[j]) sa[--bucket[s[j]]] = j;
+    }
+}
 
-    Node(char c, int f) : ch(c), freq(f), left(nullptr), right(nullptr) {}
-};
+void suffixArray(const int* s, int* sa, int n, int alphabetSize) {
+    std::vector<bool> sType(n, false);
+    sType[n - 1] = true;
+    for (int i = n - 3; i >= 0; i--) {
+        sType[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && sType[i + 1]);
+    }
+    auto isLms = [&](int i) { return i > 0 && sType[i] && !sType[i - 1]; };
 
-struct Patient {
-    std::string name;
-    int age;
-    float height;
-    float weight;
-    std::string diagnosisDate;
-    std::string diagnosis;
-};
+    // Sort the LMS substrings by inducing from their bucket ends
+    std::vector<int> bucket;
+    getBuckets(s, n, alphabetSize, bucket, true);
+    std::fill(sa, sa + n, -1);
+    for (int i = 1; i < n; i++) {
+        if (isLms(i)) sa[--bucket[s[i]]] = i;
+    }
+    induceSort(s, sa, n, alphabetSize, sType, bucket);
 
-struct compare {
-    bool operator()(Node* l, Node* r) {
-        return l->freq > r->freq;
+    // Name them; equal substrings share a name
+    int lmsCount = 0;
+    for (int i = 0; i < n; i++) {
+        if (isLms(sa[i])) sa[lmsCount++] = sa[i];
+    }
+    std::fill(sa + lmsCount, sa + n, -1);
+    int names = 0, prev = -1;
+    for (int i = 0; i < lmsCount; i++) {
+        int pos = sa[i];
+        bool differs = false;
+        for (int d = 0; d < n; d++) {
+            if (prev == -1 || s[pos + d] != s[prev + d] || sType[pos + d] != sType[prev + d]) {
+                differs = true;
+                break;
+            }
+            if (d > 0 && (isLms(pos + d) || isLms(prev + d))) break;
+        }
+        if (differs) {
+            names++;
+            prev = pos;
+        }
+        sa[lmsCount + pos / 2] = names - 1;
+    }
+    for (int i = n - 1, j = n - 1; i >= lmsCount; i--) {
+        if (sa[i] >= 0) sa[j--] = sa[i];
     }
-};
 
-void buildHuffmanTree(const std::vector<unsigned char>& data, Node*& root, std::map<char, std::string>& huffmanCode) {
-    std::map<char, int> freq;
-    for (char ch : data) {
-        freq[ch]++;
+    // Order the LMS suffixes, recursing while names repeat
+    int* reduced = sa + n - lmsCount;
+    if (names < lmsCount) {
+        suffixArray(reduced, sa, lmsCount, names);
+    } else {
+        for (int i = 0; i < lmsCount; i++) sa[reduced[i]] = i;
     }
 
-    std::priority_queue<Node*, std::vector<Node*>, compare> pq;
-    for (auto pair : freq) {
-        pq.push(new Node(pair.first, pair.second));
+    // Induce the full suffix array from the sorted LMS suffixes
+    for (int i = 1, j = 0; i < n; i++) {
+        if (isLms(i)) reduced[j++] = i;
     }
+    for (int i = 0; i < lmsCount; i++) sa[i] = reduced[sa[i]];
+    std::fill(sa + lmsCount, sa + n, -1);
+    getBuckets(s, n, alphabetSize, bucket, true);
+    for (int i = lmsCount - 1; i >= 0; i--) {
+        int j = sa[i];
+        sa[i] = -1;
+        sa[--bucket[s[j]]] = j;
+    }
+    induceSort(s, sa, n, alphabetSize, sType, bucket);
+}
 
-    while (pq.size() != 1) {
-        Node* left = pq.top(); pq.pop();
-        Node* right = pq.top(); pq.pop();
+// A transformed block: the zero-run coded MTF output and the BWT row that
+// holds the original string, which the decoder needs to invert the sort.
+struct SortedBlock {
+    uint32_t primary = 0;
+    std::vector<unsigned char> symbols;
+};
 
-        int sum = left->freq + right->freq;
-        Node* node = new Node('\0', sum);
-        node->left = left;
-        node->right = right;
-        pq.push(node);
-    }
+// Zero runs after move-to-front are written in bijective base 2 with the
+// symbols 0 and 1 (bzip2's RUNA and RUNB); a non-zero MTF index v becomes v + 1,
+// with 255 followed by v - 254 for the two largest indexes.
+SortedBlock sortBlock(const unsigned char* p, size_t size) {
+    int n = static_cast<int>(size);
+    std::vector<int> text(n + 1), sa(n + 1);
+    for (int i = 0; i < n; i++) text[i] = p[i] + 1;
+    text[n] = 0;
+    suffixArray(text.data(), sa.data(), n + 1, 257);
 
-    root = pq.top();
+    SortedBlock block;
+    block.symbols.reserve(size / 2);
+    unsigned char order[256];
+    for (int c = 0; c < 256; c++) order[c] = static_cast<unsigned char>(c);
+    size_t run = 0;
+    auto flushRun = [&]() {
+        while (run > 0) {
+            if (run & 1) {
+                block.symbols.push_back(0);
+                run = (run - 1) / 2;
+            } else {
+                block.symbols.push_back(1);
+                run = (run - 2) / 2;
+            }
+        }
+    };
 
-    std::function<void(Node*, std::string)> buildCode = [&](Node* node, std::string str) {
-        if (!node) return;
-        if (!node->left && !node->right) {
-            huffmanCode[node->ch] = str;
+    for (int i = 0; i <= n; i++) {
+        if (sa[i] == 0) {
+            block.primary = static_cast<uint32_t>(i);
+            continue;
+        }
+        unsigned char c = p[sa[i] - 1];
+        int index = 0;
+        while (order[index] != c) index++;
+        if (index == 0) {
+            run++;
+            continue;
         }
-        buildCode(node->left, str + "0");
-        buildCode(node->right, str + "1");
+        flushRun();
+        std::memmove(order + 1, order, index);
+        order[0] = c;
+        if (index < 254) {
+            block.symbols.push_back(static_cast<unsigned char>(index + 1));
+        } else {
+            block.symbols.push_back(255);
+            block.symbols.push_back(static_cast<unsigned char>(index - 254));
+        }
+    }
+    flushRun();
+    return block;
+}
+
+// 2-D LZ mode: an LZ77 parse whose match finder knows the row stride, so
+// copies from the row above or the pixel to the left are cheap to find and to
+// code. Chunks are stripes of whole rows; the hash chains cover the whole
+// stripe, so matches may reach many rows back. Every parse becomes five
+// streams: literals, literal run lengths, match lengths and distance codes,
+// each with its own Huffman table, plus the raw extra bits of the values.
+const int kLzStreams = 4;
+const int kLzMinMatch = 3;
+const size_t kLzHashBytes = 4;
+const int kLzHashBits = 16;
+const int kLzChainDepth = 4;
+const size_t kLzNiceLength = 32;
+
+// Distance codes below kLzDistanceBase name a distance relative to the stride
+enum LzDistance {
+    LZ_DISTANCE_REPEAT = 0,
+    LZ_DISTANCE_UP,
+    LZ_DISTANCE_LEFT,
+    LZ_DISTANCE_UP_LEFT,
+    LZ_DISTANCE_UP_RIGHT,
+    LZ_DISTANCE_UP_TWO,
+    kLzDistanceBase
+};
+
+// Values below 16 are their own symbol; larger ones send their two top bits
+// in the symbol and the remaining bits raw.
+struct LzValue {
+    unsigned char symbol;
+    int extraBits;
+    uint32_t extra;
+};
+
+inline LzValue lzValue(uint32_t value) {
+    if (value < 16) return LzValue{static_cast<unsigned char>(value), 0, 0};
+    int top = highBit(value);
+    return LzValue{static_cast<unsigned char>(16 + (top - 4) * 2 + ((value >> (top - 1)) & 1)), top - 1,
+                   value & ((1u << (top - 1)) - 1)};
+}
+
+struct LzParse {
+    std::vector<unsigned char> streams[kLzStreams];
+    std::vector<LzValue> extras;
+};
+
+enum LzStream { LZ_LITERALS = 0, LZ_RUNS, LZ_LENGTHS, LZ_DISTANCES };
+
+inline size_t lzMatchLength(const unsigned char* p, size_t pos, size_t distance, size_t size) {
+    size_t length = 0;
+    while (pos + length < size && p[pos + length] == p[pos + length - distance]) length++;
+    return length;
+}
+
+LzParse parseLz(const unsigned char* p, size_t size, size_t stride, size_t channels) {
+    LzParse parse;
+    parse.streams[LZ_LITERALS].reserve(size);
+    std::vector<int32_t> head(size_t(1) << kLzHashBits, -1), chain(size, -1);
+    auto hash = [&](size_t i) {
+        uint32_t value = p[i] | (p[i + 1] << 8) | (p[i + 2] << 16) | (static_cast<uint32_t>(p[i + 3]) << 24);
+        return (value * 2654435761u) >> (32 - kLzHashBits);
     };
+    auto insert = [&](size_t i) {
+        if (i + kLzHashBytes > size) return;
+        uint32_t h = hash(i);
+        chain[i] = head[h];
+        head[h] = static_cast<int32_t>(i);
+    };
+
+    const size_t special[kLzDistanceBase] = {0, stride, channels, stride + channels, stride - channels, 2 * stride};
+    size_t lastDistance = stride;
+    size_t literalRun = 0;
+    size_t i = 0;
+    while (i < size) {
+        // Cost in bits: stride-relative codes are nearly free, explicit
+        // distances pay for their extra bits. A literal costs about 6 bits.
+        size_t bestLength = 0, bestDistance = 0;
+        int bestCode = -1;
+        long bestScore = 0;
+        auto consider = [&](size_t distance, int code) {
+            if (distance == 0 || distance > i) return;
+            // Candidates come cheapest first, so one that cannot outrun the best is skipped
+            if (bestLength > 0 && (i + bestLength >= size || p[i + bestLength] != p[i + bestLength - distance])) return;
+            size_t length = lzMatchLength(p, i, distance, size);
+            if (length < kLzMinMatch) return;
+            int cost = code >= 0 ? 2 : highBit(static_cast<uint32_t>(distance)) + 4;
+            long score = static_cast<long>(length) * 6 - cost - 12;
+            if (score > bestScore) {
+                bestScore = score;
+                bestLength = length;
+                bestDistance = distance;
+                bestCode = code;
+            }
+        };
+        consider(lastDistance, LZ_DISTANCE_REPEAT);
+        for (int code = LZ_DISTANCE_UP; code < kLzDistanceBase; code++) {
+            if (special[code] != lastDistance) consider(special[code], code);
+        }
+        // Like zlib's nice_length: a long stride-relative match ends the search
+        if (bestLength < kLzNiceLength && i + kLzHashBytes <= size) {
+            int32_t candidate = head[hash(i)];
+            for (int depth = 0; candidate >= 0 && depth < kLzChainDepth; depth++, candidate = chain[candidate]) {
+                size_t distance = i - candidate;
+                bool coded = distance == lastDistance;
+                for (int code = LZ_DISTANCE_UP; code < kLzDistanceBase && !coded; code++) coded = special[code] == distance;
+                if (!coded) consider(distance, -1);
+            }
+        }
+
+        if (bestLength == 0) {
+            parse.streams[LZ_LITERALS].push_back(p[i]);
+            insert(i);
+            literalRun++;
+            i++;
+            continue;
+        }
 
-    buildCode(root, "");
+        LzValue run = lzValue(static_cast<uint32_t>(literalRun));
+        LzValue length = lzValue(static_cast<uint32_t>(bestLength - kLzMinMatch));
+        LzValue distance = bestCode >= 0 ? LzValue{static_cast<unsigned char>(bestCode), 0, 0}
+                                         : lzValue(static_cast<uint32_t>(bestDistance - 1));
+        if (bestCode < 0) distance.symbol += kLzDistanceBase;
+        parse.streams[LZ_RUNS].push_back(run.symbol);
+        parse.streams[LZ_LENGTHS].push_back(length.symbol);
+        parse.streams[LZ_DISTANCES].push_back(distance.symbol);
+        for (const LzValue& value : {run, length, distance}) {
+            if (value.extraBits > 0) parse.extras.push_back(value);
+        }
+
+        for (size_t end = i + bestLength; i < end; i++) insert(i);
+        lastDistance = bestDistance;
+        literalRun = 0;
+    }
+    return parse;
 }
 
-std::string encode(const std::vector<unsigned char>& data, const std::map<char, std::string>& huffmanCode) {
-    std::string encodedString;
-    for (char ch : data) {
-        encodedString += huffmanCode.at(ch);
+// Run-length prepass: runs of at least kMinRun equal bytes, typically uniform
+// margins, leave the Huffman stream. Each chunk starts with its run count and
+// one (literals before the run, run length, value) token per run; only the
+// bytes between runs are Huffman-coded.
+const size_t kMinRun = 32;
+
+// Length of the run of p[0] at the start of p. Eight bytes are compared per
+// step and the lowest differing byte of a little-endian word ends the run.
+inline size_t runLength(const unsigned char* p, size_t size) {
+    uint64_t pattern = 0x0101010101010101ULL * p[0];
+    size_t length = 0;
+    for (; length + 8 <= size; length += 8) {
+        uint64_t word;
+        std::memcpy(&word, p + length, sizeof(word));
+        if (word != pattern) return length + __builtin_ctzll(word ^ pattern) / 8;
     }
-    return encodedString;
+    while (length < size && p[length] == p[0]) length++;
+    return length;
 }
 
-void saveHuffmanTree(Node* root, std::string& str) {
-    if (!root) return;
-    if (!root->left && !root->right) {
-        str += "1";
-        str += root->ch;
-        return;
+struct RunSplit {
+    std::vector<unsigned char> tokens;
+    std::vector<unsigned char> literals;
+};
+
+// A short run is skipped whole: any run starting inside it ends at the same byte.
+RunSplit splitRuns(const unsigned char* p, size_t size) {
+    RunSplit split;
+    uint32_t runCount = 0;
+    split.tokens.resize(sizeof(runCount));
+    size_t literalStart = 0;
+    for (size_t i = 0; i < size;) {
+        size_t length = runLength(p + i, size - i);
+        if (length < kMinRun) {
+            split.literals.insert(split.literals.end(), p + i, p + i + length);
+            i += length;
+            continue;
+        }
+        uint32_t token[2] = {static_cast<uint32_t>(i - literalStart), static_cast<uint32_t>(length)};
+        split.tokens.insert(split.tokens.end(), reinterpret_cast<const unsigned char*>(token),
+                            reinterpret_cast<const unsigned char*>(token) + sizeof(token));
+        split.tokens.push_back(p[i]);
+        runCount++;
+        i += length;
+        literalStart = i;
+    }
+    std::memcpy(split.tokens.data(), &runCount, sizeof(runCount));
+    return split;
+}
+
+// Streaming mode: one pass over the rows with bounded memory. Each row is
+// filtered against the row above as soon as it arrives and its filter type
+// is sent inline (kStreamFilterBits), so nothing waits for the whole image.
+// The initial code comes from the first kStreamSampleBytes of filtered rows,
+// which are the only rows ever buffered. Counts start at one, so every byte
+// keeps a code and a symbol the sample never saw costs a long code rather
+// than an escape. After every kStreamSegment coded bytes (checked at row
+// ends) the encoder looks back at that segment: if a code built from it
+// would have saved more than its own size, a 1 flag and the new lengths
+// follow (refresh) and later rows use them; otherwise a 0 flag. The decision
+// only uses rows already coded, so there is no look-ahead. The bits go
+// through a zlib stream as they are drained, like the chunks of the other
+// codecs, so the deflate stage shares the pass.
+const size_t kStreamSampleBytes = 1 << 16;
+const size_t kStreamSegment = 1 << 16;
+const size_t kStreamDrainBytes = 1 << 16;
+const int kStreamLengthBits = 4;
+const int kStreamFilterBits = 3;
+
+// Receives the coded stream piece by piece.
+typedef std::function<void(const unsigned char*, size_t)> ByteSink;
+
+// Incremental deflate with one fixed output buffer.
+struct DeflateSink {
+    ByteSink sink;
+    z_stream stream{};
+    std::vector<unsigned char> buffer;
+
+    explicit DeflateSink(const ByteSink& out) : sink(out), buffer(kStreamDrainBytes) {
+        deflateInit(&stream, Z_DEFAULT_COMPRESSION);
+    }
+    ~DeflateSink() { deflateEnd(&stream); }
+
+    void write(const unsigned char* data, size_t size, int flush = Z_NO_FLUSH) {
+        stream.next_in = const_cast<Bytef*>(data);
+        stream.avail_in = static_cast<uInt>(size);
+        do {
+            stream.next_out = buffer.data();
+            stream.avail_out = static_cast<uInt>(buffer.size());
+            deflate(&stream, flush);
+            sink(buffer.data(), buffer.size() - stream.avail_out);
+        } while (stream.avail_out == 0);
     }
-    str += "0";
-    saveHuffmanTree(root->left, str);
-    saveHuffmanTree(root->right, str);
+
+    void finish() { write(nullptr, 0, Z_FINISH); }
+};
+
+struct StreamEncoder {
+    size_t rowBytes;
+    int channels;
+    int filterMode;
+    int maxCodeLength;
+    DeflateSink deflater;
+    FilterRowKernel<unsigned char> filterRow;
+    BitWriter writer;
+    std::vector<unsigned char> prevRow, residual, candidate;
+    std::vector<unsigned char> sample, sampleFilters;
+    Histogram window{};
+    size_t windowBytes = 0;
+    CodeLengths lengths{};
+    CodeTable table{};
+    bool coding = false;
+
+    StreamEncoder(size_t rowSize, int pixelChannels, int mode, int maxLength, const ByteSink& out)
+        : rowBytes(rowSize), channels(pixelChannels), filterMode(mode), maxCodeLength(maxLength), deflater(out),
+          filterRow(selectFilterRowKernel<unsigned char>(pixelChannels)),
+          prevRow(rowSize, 0), residual(rowSize), candidate(rowSize) {}
+
+    void addRow(const unsigned char* row) {
+        int type = filterMode == kFilterAuto ? FILTER_NONE : filterMode;
+        if (filterMode == kFilterAuto) {
+            uint64_t bestCost = UINT64_MAX;
+            for (int t = FILTER_NONE; t < FILTER_COUNT; t++) {
+                filterRow(t, row, prevRow.data(), rowBytes, channels, candidate.data());
+                uint64_t cost = residualCost(candidate.data(), rowBytes);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    type = t;
+                    residual.swap(candidate);
+                }
+            }
+        } else {
+            filterRow(type, row, prevRow.data(), rowBytes, channels, residual.data());
+        }
+        std::memcpy(prevRow.data(), row, rowBytes);
+
+        if (coding) {
+            codeRow(type, residual.data());
+            return;
+        }
+        sample.insert(sample.end(), residual.begin(), residual.end());
+        sampleFilters.push_back(static_cast<unsigned char>(type));
+        if (sample.size() >= kStreamSampleBytes) startCoding();
+    }
+
+    void startCoding() {
+        Histogram freq{};
+        countBytes(sample.data(), sample.size(), freq);
+        sendTable(freq);
+        coding = true;
+        for (size_t r = 0; r < sampleFilters.size(); r++) {
+            codeRow(sampleFilters[r], &sample[r * rowBytes]);
+        }
+        std::vector<unsigned char>().swap(sample);
+    }
+
+    CodeLengths buildLengths(Histogram freq) const {
+        for (uint64_t& count : freq) count++;
+        return buildCodeLengths(freq, maxCodeLength);
+    }
+
+    void sendTable(const Histogram& freq) {
+        lengths = buildLengths(freq);
+        table = buildCanonicalCode(lengths);
+        for (int s = 0; s < 256; s++) writer.put(lengths[s], kStreamLengthBits);
+    }
+
+    void codeRow(int type, const unsigned char* row) {
+        writer.put(type, kStreamFilterBits);
+        encodeInto(writer, row, rowBytes, table);
+        countBytes(row, rowBytes, window);
+        windowBytes += rowBytes;
+        if (windowBytes >= kStreamSegment) checkpoint();
+        // Whole words only, so the pending bits stay in the accumulator
+        if (writer.used >= kStreamDrainBytes) {
+            deflater.write(writer.bytes.data(), writer.used);
+            writer.used = 0;
+        }
+    }
+
+    void checkpoint() {
+        CodeLengths fresh = buildLengths(window);
+        uint64_t currentCost = 0;
+        uint64_t freshCost = 256 * kStreamLengthBits;
+        for (int s = 0; s < 256; s++) {
+            currentCost += window[s] * lengths[s];
+            freshCost += window[s] * fresh[s];
+        }
+        bool refresh = freshCost < currentCost;
+        writer.put(refresh ? 1 : 0, 1);
+        if (refresh) sendTable(window);
+        window.fill(0);
+        windowBytes = 0;
+    }
+
+    void finish() {
+        if (!coding) startCoding();
+        writer.finish();
+        deflater.write(writer.bytes.data(), writer.bytes.size());
+        deflater.finish();
+    }
+};
+
+// Everything in a .pap file before the data section.
+void writePapHeader(std::ofstream& outFile, const PapHeader& header) {
+    outFile.write(reinterpret_cast<const char*>(&header.width), sizeof(header.width));
+    outFile.write(reinterpret_cast<const char*>(&header.height), sizeof(header.height));
+    outFile.write(reinterpret_cast<const char*>(&header.channels), sizeof(header.channels));
+
+    outFile.write(reinterpret_cast<const char*>(&header.codec), sizeof(header.codec));
+    outFile.write(reinterpret_cast<const char*>(&header.transforms), sizeof(header.transforms));
+    uint32_t transformDataSize = header.transformData.size();
+    outFile.write(reinterpret_cast<const char*>(&transformDataSize), sizeof(transformDataSize));
+    outFile.write(header.transformData.c_str(), transformDataSize);
 }
 
-void saveToFile(const std::string& filename, const std::string& encryptedData, const std::string& encryptedTree, const std::string& patientData, int width, int height, int channels) {
+void saveToFile(const std::string& filename, const PapHeader& header, const std::string& encryptedData, const std::string& codecTables, const std::string& patientData) {
     std::ofstream outFile(filename, std::ios::binary);
     if (!outFile) {
         std::cerr << "Error opening file for writing." << std::endl;
         return;
     }
 
-    outFile.write(reinterpret_cast<const char*>(&width), sizeof(width));
-    outFile.write(reinterpret_cast<const char*>(&height), sizeof(height));
-    outFile.write(reinterpret_cast<const char*>(&channels), sizeof(channels));
+    writePapHeader(outFile, header);
 
     uint32_t encryptedSize = encryptedData.size();
     outFile.write(reinterpret_cast<const char*>(&encryptedSize), sizeof(encryptedSize));
@@ -109,9 +2218,10 @@ void saveToFile(const std::string& filename, const std::string& encryptedData, c
     outFile.write(reinterpret_cast<const char*>(&encryptedPatientDataSize), sizeof(encryptedPatientDataSize));
     outFile.write(patientData.c_str(), encryptedPatientDataSize);
 
-    uint32_t treeSize = encryptedTree.size();
-    outFile.write(reinterpret_cast<const char*>(&treeSize), sizeof(treeSize));
-    outFile.write(encryptedTree.c_str(), treeSize);
+    // Tables the codec needs to decode, e.g. the Huffman code lengths
+    uint32_t tableSize = codecTables.size();
+    outFile.write(reinterpret_cast<const char*>(&tableSize), sizeof(tableSize));
+    outFile.write(codecTables.c_str(), tableSize);
 
     outFile.close();
 }
@@ -168,41 +2278,828 @@ std::string hillCipher(const std::string& text, int key[2][2], int mod) {
     return encryptedText;
 }
 
-int main() {
-    Patient patient;
-    getPatientData(patient);
+struct Options {
+    int maxCodeLength = 12;
+    size_t chunkSize = kDefaultChunkSize;
+    int tableCount = 1;
+    int filter = kFilterAuto;
+    bool reduceChannels = true;
+    bool palette = true;
+    bool lowBits = true;
+    bool colorTransform = false;
+    bool planar = false;
+    int codec = CODEC_HUFFMAN;
+    uint32_t staticTable = 0;
+    std::string trainName;
+    std::string tableFile;
+    std::vector<std::string> trainImages;
+};
 
-    std::string filename;
-    std::cout << "Enter image filename (with .jpg extension): ";
-    std::cin >> filename;
+// Parses --name=value flags; returns false on an unknown flag or bad value.
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--max-code-length") {
+            options.maxCodeLength = std::atoi(value.c_str());
+            if (options.maxCodeLength < kMinCodeLength || options.maxCodeLength > kMaxCodeLength) {
+                std::cerr << "--max-code-length must be between " << kMinCodeLength << " and " << kMaxCodeLength << "." << std::endl;
+                return false;
+            }
+        } else if (name == "--chunk-size") {
+            long long chunkSize = std::atoll(value.c_str());
+            if (chunkSize < static_cast<long long>(kMinChunkSize) || chunkSize > (1LL << 30)) {
+                std::cerr << "--chunk-size must be between " << kMinChunkSize << " and " << (1 << 30) << " bytes." << std::endl;
+                return false;
+            }
+            options.chunkSize = static_cast<size_t>(chunkSize);
+        } else if (name == "--tables") {
+            options.tableCount = std::atoi(value.c_str());
+            if (options.tableCount < 1 || options.tableCount > kMaxTables) {
+                std::cerr << "--tables must be between 1 and " << kMaxTables << "." << std::endl;
+                return false;
+            }
+        } else if (name == "--filter") {
+            static const char* const names[] = {"none", "sub", "up", "average", "paeth"};
+            options.filter = value == "auto" ? kFilterAuto : FILTER_COUNT;
+            for (int type = FILTER_NONE; type < FILTER_COUNT; type++) {
+                if (value == names[type]) options.filter = type;
+            }
+            if (options.filter == FILTER_COUNT) {
+                std::cerr << "--filter must be auto, none, sub, up, average or paeth." << std::endl;
+                return false;
+            }
+        } else if (name == "--reduce") {
+            if (value != "none" && value != "auto") {
+                std::cerr << "--reduce must be none or auto." << std::endl;
+                return false;
+            }
+            options.reduceChannels = value == "auto";
+        } else if (name == "--palette") {
+            if (value != "none" && value != "auto") {
+                std::cerr << "--palette must be none or auto." << std::endl;
+                return false;
+            }
+            options.palette = value == "auto";
+        } else if (name == "--low-bits") {
+            if (value != "none" && value != "auto") {
+                std::cerr << "--low-bits must be none or auto." << std::endl;
+                return false;
+            }
+            options.lowBits = value == "auto";
+        } else if (name == "--color") {
+            if (value != "none" && value != "ycocg") {
+                std::cerr << "--color must be none or ycocg." << std::endl;
+                return false;
+            }
+            options.colorTransform = value == "ycocg";
+        } else if (name == "--planar") {
+            options.planar = true;
+        } else if (name == "--codec") {
+            if (value == "huffman") {
+                options.codec = CODEC_HUFFMAN;
+            } else if (value == "loco") {
+                options.codec = CODEC_LOCO;
+            } else if (value == "rans") {
+                options.codec = CODEC_RANS;
+            } else if (value == "fse") {
+                options.codec = CODEC_FSE;
+            } else if (value == "max") {
+                options.codec = CODEC_ARITH;
+            } else if (value == "pairs") {
+                options.codec = CODEC_PAIRS;
+            } else if (value == "bwt") {
+                options.codec = CODEC_BWT;
+            } else if (value == "lz") {
+                options.codec = CODEC_LZ;
+            } else if (value == "rle") {
+                options.codec = CODEC_RLE;
+            } else if (value == "stream") {
+                options.codec = CODEC_STREAM;
+            } else {
+                std::cerr << "--codec must be huffman, rle, stream, pairs, bwt, lz, loco, rans, fse or max." << std::endl;
+                return false;
+            }
+        } else if (name == "--static-table") {
+            options.staticTable = static_cast<uint32_t>(std::atoll(value.c_str()));
+            if (findPretrainedHuffmanTable(options.staticTable) == nullptr) {
+                std::cerr << "--static-table must name a table in TablasHuffman.h." << std::endl;
+                return false;
+            }
+        } else if (name == "--train") {
+            options.trainName = value;
+            if (value.empty() || value.find_first_of("\"\\\n") != std::string::npos) {
+                std::cerr << "--train needs a table name without quotes or backslashes." << std::endl;
+                return false;
+            }
+        } else if (name == "--table-file") {
+            options.tableFile = value;
+            if (value.empty()) {
+                std::cerr << "--table-file needs the path of the registry header to write." << std::endl;
+                return false;
+            }
+        } else if (!options.trainName.empty() && arg.compare(0, 2, "--") != 0) {
+            options.trainImages.push_back(arg);
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.codec == CODEC_STREAM && options.planar) {
+        std::cerr << "--planar cannot be combined with --codec=stream." << std::endl;
+        return false;
+    }
+    // --static-table picks the code of the huffman codec, in any flag order
+    if (options.staticTable != 0) {
+        if (options.codec != CODEC_HUFFMAN) {
+            std::cerr << "--static-table only works with --codec=huffman." << std::endl;
+            return false;
+        }
+        options.codec = CODEC_STATIC_HUFFMAN;
+    }
+    if (options.codec == CODEC_STATIC_HUFFMAN && options.tableCount != 1) {
+        std::cerr << "--static-table cannot be combined with --tables." << std::endl;
+        return false;
+    }
+    if (!options.trainName.empty() && options.trainImages.empty()) {
+        std::cerr << "--train needs at least one image after the flags." << std::endl;
+        return false;
+    }
+    if (!options.trainName.empty() && options.tableFile.empty()) {
+        std::cerr << "--train needs --table-file=<path>, e.g. --table-file=TablasHuffman.h." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Huffman-codes the data with one or several trained tables and deflates
+// every chunk; the code lengths of each table go to codecTables.
+std::string compressHuffman(const std::vector<unsigned char>& data, const Options& options, std::string& codecTables) {
+    Histogram freq = buildHistogram(data);
+    std::vector<CodeLengths> codeLengths(1, buildCodeLengths(freq, options.maxCodeLength));
+    CodeTable codeTable = buildCanonicalCode(codeLengths[0]);
+
+    // Huffman-code and deflate every chunk on its own worker thread
+    std::string compressedData = packChunks(data, options.chunkSize, [&](const unsigned char* chunk, size_t size) {
+        return deflateChunk(encode(chunk, size, codeTable));
+    });
+
+    // Extra tables pay for their 256 stored lengths and the selectors, and
+    // switching codes every group hides repeats from deflate, so small or
+    // uniform images code smaller with one table. The multi-table layout is
+    // only kept when it comes out smaller.
+    if (options.tableCount > 1) {
+        std::vector<TableGroup> groups = splitTableGroups(data.size(), options.chunkSize);
+        std::vector<unsigned char> selectors;
+        std::vector<CodeLengths> multiLengths = trainCodeTables(data, groups, freq, options.tableCount, options.maxCodeLength, selectors);
+        std::vector<CodeTable> codeTables;
+        for (const CodeLengths& lengths : multiLengths) {
+            codeTables.push_back(buildCanonicalCode(lengths));
+        }
+
+        size_t groupsPerChunk = (options.chunkSize + kTableGroupSize - 1) / kTableGroupSize;
+        std::string multiData = packChunks(data, options.chunkSize, [&](const unsigned char* chunk, size_t size) {
+            size_t index = (chunk - data.data()) / options.chunkSize;
+            return deflateChunk(encodeWithSelectors(chunk, size, &selectors[index * groupsPerChunk], codeTables));
+        });
+        if (multiData.size() + (multiLengths.size() - 1) * 256 < compressedData.size()) {
+            compressedData.swap(multiData);
+            codeLengths.swap(multiLengths);
+        }
+    }
+
+    // Only 256 canonical code lengths per table are stored; the decoder rebuilds the codes
+    for (const CodeLengths& lengths : codeLengths) {
+        codecTables.append(lengths.begin(), lengths.end());
+    }
+    return compressedData;
+}
+
+// Same chunk coding as a single-table Huffman run, but the code comes from the
+// compiled-in registry: no histogram or tree pass, and only the table ID is stored.
+std::string compressStaticHuffman(const std::vector<unsigned char>& data, const Options& options, std::string& codecTables) {
+    const PretrainedHuffmanTable* table = findPretrainedHuffmanTable(options.staticTable);
+    CodeLengths lengths;
+    std::copy(std::begin(table->lengths), std::end(table->lengths), lengths.begin());
+    CodeTable codeTable = buildCanonicalCode(lengths);
+
+    appendU32(codecTables, table->id);
+    return packChunks(data, options.chunkSize, [&](const unsigned char* chunk, size_t size) {
+        return deflateChunk(encode(chunk, size, codeTable));
+    });
+}
+
+// Pair-alphabet Huffman; the 65536 code lengths are mostly zero, so they are
+// stored deflated.
+std::string compressPairs(const std::vector<unsigned char>& data, const Options& options, std::string& codecTables) {
+    std::vector<uint8_t> lengths = buildPairCodeLengths(buildPairHistogram(data));
+    std::vector<HuffmanCode> table = buildPairCanonicalCode(lengths);
+    std::vector<unsigned char> storedLengths = deflateChunk(std::vector<unsigned char>(lengths.begin(), lengths.end()));
+    codecTables.append(storedLengths.begin(), storedLengths.end());
+
+    size_t chunkSize = (options.chunkSize + 1) & ~size_t(1);
+    return packChunks(data, chunkSize, [&](const unsigned char* chunk, size_t size) {
+        return deflateChunk(encodePairs(chunk, size, table));
+    });
+}
+
+// Every chunk is sorted on its own thread first, so the shared table can be
+// trained on the transformed symbols. Chunks carry their primary index and
+// symbol count ahead of the codes; the output is not deflated.
+std::string compressBwt(const std::vector<unsigned char>& data, const Options& options, std::string& codecTables) {
+    size_t chunkCount = (data.size() + options.chunkSize - 1) / options.chunkSize;
+    std::vector<SortedBlock> blocks(chunkCount);
+    parallelFor(chunkCount, [&](size_t i) {
+        size_t begin = i * options.chunkSize;
+        blocks[i] = sortBlock(data.data() + begin, std::min(options.chunkSize, data.size() - begin));
+    });
+
+    Histogram freq{};
+    for (const SortedBlock& block : blocks) countBytes(block.symbols.data(), block.symbols.size(), freq);
+    CodeLengths lengths = buildCodeLengths(freq, options.maxCodeLength);
+    CodeTable codeTable = buildCanonicalCode(lengths);
+    codecTables.append(lengths.begin(), lengths.end());
+
+    return packChunks(data, options.chunkSize, [&](const unsigned char* chunk, size_t) {
+        const SortedBlock& block = blocks[(chunk - data.data()) / options.chunkSize];
+        uint32_t prefix[2] = {block.primary, static_cast<uint32_t>(block.symbols.size())};
+        BitWriter writer;
+        writer.reserve(sizeof(prefix) + block.symbols.size());
+        writer.putBytes(reinterpret_cast<const unsigned char*>(prefix), sizeof(prefix));
+        encodeInto(writer, block.symbols.data(), block.symbols.size(), codeTable);
+        writer.finish();
+        return std::move(writer.bytes);
+    });
+}
+
+// The table is trained on the bytes left between runs, so margins do not
+// skew it; chunks are then deflated like plain Huffman chunks.
+std::string compressRuns(const std::vector<unsigned char>& data, const Options& options, std::string& codecTables) {
+    size_t chunkCount = (data.size() + options.chunkSize - 1) / options.chunkSize;
+    std::vector<RunSplit> splits(chunkCount);
+    parallelFor(chunkCount, [&](size_t i) {
+        size_t begin = i * options.chunkSize;
+        splits[i] = splitRuns(data.data() + begin, std::min(options.chunkSize, data.size() - begin));
+    });
 
-    int width, height, channels;
-    unsigned char* img = stbi_load(filename.c_str(), &width, &height, &channels, 0);
+    Histogram freq{};
+    for (const RunSplit& split : splits) countBytes(split.literals.data(), split.literals.size(), freq);
+    if (std::all_of(freq.begin(), freq.end(), [](uint64_t f) { return f == 0; })) freq[0] = 1;
+    CodeLengths lengths = buildCodeLengths(freq, options.maxCodeLength);
+    CodeTable codeTable = buildCanonicalCode(lengths);
+    codecTables.append(lengths.begin(), lengths.end());
+
+    return packChunks(data, options.chunkSize, [&](const unsigned char* chunk, size_t) {
+        const RunSplit& split = splits[(chunk - data.data()) / options.chunkSize];
+        BitWriter writer;
+        writer.reserve(split.tokens.size() + split.literals.size());
+        writer.putBytes(split.tokens.data(), split.tokens.size());
+        encodeInto(writer, split.literals.data(), split.literals.size(), codeTable);
+        writer.finish();
+        return deflateChunk(writer.bytes);
+    });
+}
+
+// In-memory use of the streaming codec, for 16-bit byte planes and the
+// trainer; 8-bit files are streamed straight to disk by streamToFile(). Rows
+// the filter stage already predicted are coded as they are, and the tables
+// travel inside the stream, so codecTables stays empty.
+std::string compressStream(const std::vector<unsigned char>& data, const PapHeader& header, const Options& options) {
+    std::string coded;
+    size_t rowBytes = static_cast<size_t>(header.width) * header.channels;
+    int filter = (header.transforms & kTransformFilter) ? static_cast<int>(FILTER_NONE) : options.filter;
+    StreamEncoder encoder(rowBytes, header.channels, filter, options.maxCodeLength,
+                          [&](const unsigned char* bytes, size_t size) { coded.append(reinterpret_cast<const char*>(bytes), size); });
+    for (size_t offset = 0; offset < data.size(); offset += rowBytes) {
+        encoder.addRow(&data[offset]);
+    }
+    encoder.finish();
+    return coded;
+}
+
+// rANS codes every chunk on its own; the 256 normalized frequencies are stored
+// as 16-bit values. Its output is already near the entropy, so it is not deflated.
+std::string compressRans(const std::vector<unsigned char>& data, const Options& options, std::string& codecTables) {
+    NormalizedCounts norm = normalizeFrequencies(buildHistogram(data), kRansScaleBits);
+    RansEncTable table = buildRansEncTable(norm);
+    for (uint32_t freq : norm) {
+        uint16_t value = static_cast<uint16_t>(freq);
+        codecTables.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    return packChunks(data, options.chunkSize, [&](const unsigned char* chunk, size_t size) {
+        return encodeRans(chunk, size, table);
+    });
+}
+
+// FSE codes every chunk on its own with one shared table; only the compact
+// normalized counts go to the header.
+std::string compressFse(const std::vector<unsigned char>& data, const Options& options, std::string& codecTables) {
+    NormalizedCounts norm = normalizeFrequencies(buildHistogram(data), kFseTableLog);
+    FseEncTable table = buildFseEncTable(norm, kFseTableLog);
+    writeFseCounts(norm, kFseTableLog, codecTables);
+    return packChunks(data, options.chunkSize, [&](const unsigned char* chunk, size_t size) {
+        return encodeFse(chunk, size, table);
+    });
+}
+
+// Stripe codecs (LOCO-I, "max" and 2-D LZ) round chunks down to whole rows.
+size_t stripeSize(const PapHeader& header, const Options& options) {
+    size_t rowBytes = static_cast<size_t>(header.width) * header.channels;
+    return std::max<size_t>(1, options.chunkSize / rowBytes) * rowBytes;
+}
+
+// Stripes are parsed in parallel first so the stream tables can be trained on
+// every parse; the tables are stored deflated. Chunk layout: literal count
+// and sequence count, the four Huffman-coded streams back to back, then the
+// extra bits in sequence order.
+std::string compressLz(const std::vector<unsigned char>& data, const PapHeader& header, const Options& options, std::string& codecTables) {
+    size_t chunkSize = stripeSize(header, options);
+    size_t stride = static_cast<size_t>(header.width) * header.channels;
+    size_t chunkCount = (data.size() + chunkSize - 1) / chunkSize;
+    std::vector<LzParse> parses(chunkCount);
+    parallelFor(chunkCount, [&](size_t i) {
+        size_t begin = i * chunkSize;
+        parses[i] = parseLz(data.data() + begin, std::min(chunkSize, data.size() - begin), stride, header.channels);
+    });
+
+    CodeTable codeTables[kLzStreams];
+    std::vector<unsigned char> allLengths;
+    for (int stream = 0; stream < kLzStreams; stream++) {
+        Histogram freq{};
+        for (const LzParse& parse : parses) {
+            countBytes(parse.streams[stream].data(), parse.streams[stream].size(), freq);
+        }
+        if (std::all_of(freq.begin(), freq.end(), [](uint64_t f) { return f == 0; })) freq[0] = 1;
+        CodeLengths lengths = buildCodeLengths(freq, options.maxCodeLength);
+        codeTables[stream] = buildCanonicalCode(lengths);
+        allLengths.insert(allLengths.end(), lengths.begin(), lengths.end());
+    }
+    // The four tables are mostly zeros and matter on small images
+    std::vector<unsigned char> storedLengths = deflateChunk(allLengths);
+    codecTables.append(storedLengths.begin(), storedLengths.end());
+
+    return packChunks(data, chunkSize, [&](const unsigned char* chunk, size_t size) {
+        const LzParse& parse = parses[(chunk - data.data()) / chunkSize];
+        uint32_t counts[2] = {static_cast<uint32_t>(parse.streams[LZ_LITERALS].size()),
+                              static_cast<uint32_t>(parse.streams[LZ_RUNS].size())};
+        BitWriter writer;
+        writer.reserve(sizeof(counts) + size);
+        writer.putBytes(reinterpret_cast<const unsigned char*>(counts), sizeof(counts));
+        for (int stream = 0; stream < kLzStreams; stream++) {
+            encodeInto(writer, parse.streams[stream].data(), parse.streams[stream].size(), codeTables[stream]);
+        }
+        for (const LzValue& value : parse.extras) writer.put(value.extra, value.extraBits);
+        writer.finish();
+        return std::move(writer.bytes);
+    });
+}
+
+// LOCO-I needs no tables and no deflate pass.
+std::string compressLoco(const std::vector<unsigned char>& data, const PapHeader& header, const Options& options) {
+    return packChunks(data, stripeSize(header, options), [&](const unsigned char* stripe, size_t size) {
+        return encodeLocoStripe(stripe, size, header.width, header.channels);
+    });
+}
+
+std::string compressArith(const std::vector<unsigned char>& data, const PapHeader& header, const Options& options) {
+    return packChunks(data, stripeSize(header, options), [&](const unsigned char* stripe, size_t size) {
+        return encodeArithStripe(stripe, size, header.width, header.channels);
+    });
+}
+
+// Runs the selected entropy backend over data; its tables go to codecTables.
+std::string compressData(const std::vector<unsigned char>& data, const PapHeader& header, const Options& options, std::string& codecTables) {
+    switch (options.codec) {
+    case CODEC_LOCO:
+        return compressLoco(data, header, options);
+    case CODEC_RANS:
+        return compressRans(data, options, codecTables);
+    case CODEC_FSE:
+        return compressFse(data, options, codecTables);
+    case CODEC_ARITH:
+        return compressArith(data, header, options);
+    case CODEC_STATIC_HUFFMAN:
+        return compressStaticHuffman(data, options, codecTables);
+    case CODEC_PAIRS:
+        return compressPairs(data, options, codecTables);
+    case CODEC_BWT:
+        return compressBwt(data, options, codecTables);
+    case CODEC_LZ:
+        return compressLz(data, header, options, codecTables);
+    case CODEC_RLE:
+        return compressRuns(data, options, codecTables);
+    case CODEC_STREAM:
+        return compressStream(data, header, options);
+    default:
+        return compressHuffman(data, options, codecTables);
+    }
+}
+
+// Planar mode: every channel becomes its own stream with its own model, and
+// the planes are coded in parallel. Both the data section and the table block
+// hold one "u32 size + bytes" section per channel, in channel order.
+std::string compressPlanar(const std::vector<unsigned char>& data, const PapHeader& header, const Options& options, std::string& codecTables) {
+    size_t planeSize = static_cast<size_t>(header.width) * header.height;
+    PapHeader planeHeader = header;
+    planeHeader.channels = 1;
+    std::vector<std::string> sections(header.channels), tables(header.channels);
+    parallelFor(header.channels, [&](size_t c) {
+        std::vector<unsigned char> plane(planeSize);
+        for (size_t i = 0; i < planeSize; i++) plane[i] = data[i * header.channels + c];
+        sections[c] = compressData(plane, planeHeader, options, tables[c]);
+    });
+
+    std::string packed;
+    for (int c = 0; c < header.channels; c++) {
+        appendU32(packed, static_cast<uint32_t>(sections[c].size()));
+        packed += sections[c];
+        appendU32(codecTables, static_cast<uint32_t>(tables[c].size()));
+        codecTables += tables[c];
+    }
+    return packed;
+}
+
+// stb_image 2.29 returns 16-bit PNM samples as they are stored in the file,
+// big-endian, while every other format comes back in host order.
+bool isPnmFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[2] = {};
+    file.read(magic, 2);
+    return file && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6');
+}
+
+// Loads a 16-bit image and runs the stages that apply to it: channel
+// reduction, low-bit packing and the filter, which runs for every codec here
+// because the byte planes are no longer samples LOCO-I or "max" could
+// predict. The palette and the color transform are 8-bit only. Returns the
+// byte planes, with header.channels counting two byte channels per sample.
+bool loadWideImage(const std::string& filename, PapHeader& header, const Options& options, std::vector<unsigned char>& data) {
+    stbi_us* img = stbi_load_16(filename.c_str(), &header.width, &header.height, &header.channels, 0);
     if (img == nullptr) {
+        return false;
+    }
+    std::vector<uint16_t> samples(img, img + static_cast<size_t>(header.width) * header.height * header.channels);
+    stbi_image_free(img);
+    if (isPnmFile(filename)) {
+        for (uint16_t& v : samples) {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v);
+            v = static_cast<uint16_t>((bytes[0] << 8) | bytes[1]);
+        }
+    }
+
+    if (options.reduceChannels) {
+        reduceChannels(samples, header);
+    }
+    if (options.lowBits) {
+        shiftOutLowBits(samples, header);
+    }
+    if (options.filter != FILTER_NONE) {
+        std::vector<unsigned char> rowFilters;
+        samples = filterImage(samples, header.width, header.height, header.channels, options.filter, rowFilters);
+        header.transforms |= kTransformFilter;
+        header.transformData.append(rowFilters.begin(), rowFilters.end());
+    }
+
+    data = splitBytePlanes(samples, (header.transforms & kTransformFilter) != 0);
+    header.channels *= 2;
+    header.transforms |= kTransformWide | kTransformPlanar;
+    return true;
+}
+
+// The stages that run on an 8-bit image after the palette decision, in the
+// order the decoder expects their parameters: low bits, color transform,
+// filter, and the planar flag.
+void runSampleStages(std::vector<unsigned char>& data, PapHeader& header, const Options& options) {
+    if (options.lowBits) {
+        shiftOutLowBits(data, header);
+    }
+
+    // The color transform runs before filtering so the predictors see decorrelated planes
+    if (options.colorTransform && header.channels >= 3) {
+        forwardColorTransform(data, header.channels);
+        header.transforms |= kTransformColor;
+    }
+
+    // "--filter=none" skips the stage entirely; a forced filter is still recorded
+    // per row. LOCO-I and "max" have their own predictor and code the raw samples.
+    if (options.filter != FILTER_NONE && options.codec != CODEC_LOCO && options.codec != CODEC_ARITH) {
+        std::vector<unsigned char> rowFilters;
+        data = filterImage(data, header.width, header.height, header.channels, options.filter, rowFilters);
+        header.transforms |= kTransformFilter;
+        header.transformData.append(rowFilters.begin(), rowFilters.end());
+    }
+
+    if (options.planar && header.channels > 1) {
+        header.transforms |= kTransformPlanar;
+    }
+}
+
+// Output of the codec stage together with the header that describes it.
+struct CodedImage {
+    PapHeader header;
+    std::string data;
+    std::string tables;
+
+    size_t size() const { return header.transformData.size() + data.size() + tables.size(); }
+};
+
+// Planar mode runs last, so the decoder re-interleaves before undoing the other stages
+CodedImage runCodec(const std::vector<unsigned char>& data, const PapHeader& header, const Options& options) {
+    CodedImage coded;
+    coded.header = header;
+    coded.header.codec = options.codec;
+    if (header.transforms & kTransformPlanar) {
+        coded.data = compressPlanar(data, coded.header, options, coded.tables);
+    } else {
+        coded.data = compressData(data, coded.header, options, coded.tables);
+    }
+    return coded;
+}
+
+// Runs every 8-bit stage and the codec. A palette only wins on some images:
+// smooth gradients with few colors often code smaller as filtered RGB, and
+// no cheap estimate tracks every codec, so when the image fits a palette both
+// layouts are coded and the smaller one is kept. `staged`, when given,
+// receives the bytes the codec saw for the chosen layout.
+CodedImage compressImage(std::vector<unsigned char> data, PapHeader header, const Options& options, std::vector<unsigned char>* staged = nullptr) {
+    // Redundant channels go first so no later stage spends work on them
+    if (options.reduceChannels) {
+        reduceChannels(data, header);
+    }
+
+    // A palette leaves a single plane of indices, so the color transform is skipped
+    std::vector<unsigned char> indices;
+    PapHeader paletteHeader = header;
+    if (options.palette && header.channels > 1) {
+        indices = data;
+        if (!paletteImage(indices, paletteHeader)) {
+            std::vector<unsigned char>().swap(indices);
+        }
+    }
+
+    runSampleStages(data, header, options);
+    CodedImage coded = runCodec(data, header, options);
+    if (!indices.empty()) {
+        runSampleStages(indices, paletteHeader, options);
+        CodedImage withPalette = runCodec(indices, paletteHeader, options);
+        if (withPalette.size() < coded.size()) {
+            coded = std::move(withPalette);
+            data.swap(indices);
+        }
+    }
+    if (staged != nullptr) {
+        staged->swap(data);
+    }
+    return coded;
+}
+
+// "max" still loses to the default codec on some images (noise, and synthetic
+// ones whose repeats deflate finds), so it is run next to Huffman and the
+// smaller result is kept; the header records the codec that won.
+CodedImage codeSmallest(const Options& options, const std::function<CodedImage(const Options&)>& code) {
+    CodedImage coded = code(options);
+    if (options.codec == CODEC_ARITH) {
+        Options fallback = options;
+        fallback.codec = CODEC_HUFFMAN;
+        CodedImage huffman = code(fallback);
+        if (huffman.size() < coded.size()) {
+            coded = std::move(huffman);
+        }
+    }
+    return coded;
+}
+
+// Hands out an 8-bit image one row at a time. Binary PGM/PPM files are read
+// straight from disk, so only one row is ever held; other formats go through
+// stbi_load(), which decodes the whole file up front.
+struct RowSource {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::ifstream file;
+    unsigned char* image = nullptr;
+    std::vector<unsigned char> row;
+    int nextRow = 0;
+
+    ~RowSource() {
+        if (image != nullptr) stbi_image_free(image);
+    }
+
+    bool open(const std::string& filename) {
+        if (openPnm(filename)) return true;
+        image = stbi_load(filename.c_str(), &width, &height, &channels, 0);
+        return image != nullptr;
+    }
+
+    size_t rowBytes() const { return static_cast<size_t>(width) * channels; }
+
+    // Only 8-bit P5/P6 files; anything else is left to stb_image.
+    bool openPnm(const std::string& filename) {
+        file.open(filename, std::ios::binary);
+        char magic[2] = {};
+        file.read(magic, 2);
+        int maxValue = 0;
+        if (!file || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6') ||
+            !readPnmValue(width) || !readPnmValue(height) || !readPnmValue(maxValue) ||
+            width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 255) {
+            file.close();
+            return false;
+        }
+        file.get(); // the single whitespace byte before the raster
+        channels = magic[1] == '5' ? 1 : 3;
+        row.resize(rowBytes());
+        return true;
+    }
+
+    bool readPnmValue(int& value) {
+        int c = file.get();
+        while (c == '#' || std::isspace(c)) {
+            if (c == '#') {
+                while (c != '\n' && c != EOF) c = file.get();
+            }
+            c = file.get();
+        }
+        if (!std::isdigit(c)) return false;
+        value = 0;
+        while (std::isdigit(c)) {
+            value = value * 10 + (c - '0');
+            c = file.get();
+        }
+        file.unget();
+        return true;
+    }
+
+    // nullptr once the file runs short.
+    const unsigned char* next() {
+        size_t y = nextRow++;
+        if (image != nullptr) return image + y * rowBytes();
+        file.read(reinterpret_cast<char*>(row.data()), row.size());
+        return file ? row.data() : nullptr;
+    }
+};
+
+// --codec=stream on an 8-bit image: rows go from the source through the
+// encoder into the output file as they are read, and the data size is patched
+// in after the last row. The color transform is per pixel and runs on each
+// row, and the filter runs per row in the encoder. Channel reduction, the
+// palette, low bits and planar mode need every pixel before the first byte
+// can be coded, so this path skips them.
+bool streamToFile(const std::string& imageName, const std::string& outName, const Options& options, const std::string& patientData) {
+    RowSource source;
+    if (!source.open(imageName)) {
         std::cerr << "Could not open or find the image." << std::endl;
-        return -1;
+        return false;
+    }
+    std::cout << "Stream mode: channel reduction, palette and low-bit stages are skipped." << std::endl;
+    std::ofstream outFile(outName, std::ios::binary);
+    if (!outFile) {
+        std::cerr << "Error opening file for writing." << std::endl;
+        return false;
     }
 
-    std::vector<unsigned char> data(img, img + width * height * channels);
-    stbi_image_free(img);
+    PapHeader header;
+    header.width = source.width;
+    header.height = source.height;
+    header.channels = source.channels;
+    header.codec = CODEC_STREAM;
+    bool colored = options.colorTransform && header.channels >= 3;
+    if (colored) {
+        header.transforms |= kTransformColor;
+    }
+    writePapHeader(outFile, header);
+
+    std::streampos sizePosition = outFile.tellp();
+    uint32_t encryptedSize = 0;
+    outFile.write(reinterpret_cast<const char*>(&encryptedSize), sizeof(encryptedSize));
+    StreamEncoder encoder(source.rowBytes(), source.channels, options.filter, options.maxCodeLength,
+                          [&](const unsigned char* bytes, size_t size) {
+                              outFile.write(reinterpret_cast<const char*>(bytes), size);
+                              encryptedSize += size;
+                          });
+    std::vector<unsigned char> pixels(source.rowBytes());
+    for (int y = 0; y < source.height; y++) {
+        const unsigned char* row = source.next();
+        if (row == nullptr) {
+            std::cerr << "The image file is truncated." << std::endl;
+            return false;
+        }
+        if (colored) {
+            std::memcpy(pixels.data(), row, pixels.size());
+            forwardColorTransform(pixels, header.channels);
+            row = pixels.data();
+        }
+        encoder.addRow(row);
+    }
+    encoder.finish();
+
+    uint32_t encryptedPatientDataSize = patientData.size();
+    outFile.write(reinterpret_cast<const char*>(&encryptedPatientDataSize), sizeof(encryptedPatientDataSize));
+    outFile.write(patientData.c_str(), encryptedPatientDataSize);
+    uint32_t tableSize = 0;
+    outFile.write(reinterpret_cast<const char*>(&tableSize), sizeof(tableSize));
+
+    outFile.seekp(sizePosition);
+    outFile.write(reinterpret_cast<const char*>(&encryptedSize), sizeof(encryptedSize));
+    return static_cast<bool>(outFile);
+}
+
+// Builds one static table from the summed histograms of a corpus, run through
+// the same stages as a normal compression (loadWideImage() or compressImage(),
+// so the palette decision matches too), and writes the registry header at
+// --table-file with the compiled-in tables plus the new one under the next
+// free ID.
+// Every symbol gets a code so any image can be coded with the table.
+bool trainStaticTable(const Options& options) {
+    Histogram freq{};
+    for (const std::string& filename : options.trainImages) {
+        // Train on exactly the bytes main() would hand to the codec: 16-bit
+        // sources become their byte planes, and 8-bit ones go through
+        // reduction, the palette decision, low bits, color and filter
+        PapHeader header;
+        std::vector<unsigned char> staged;
+        if (stbi_is_16_bit(filename.c_str())) {
+            if (!loadWideImage(filename, header, options, staged)) {
+                std::cerr << "Could not open or find the image " << filename << "." << std::endl;
+                return false;
+            }
+        } else {
+            unsigned char* img = stbi_load(filename.c_str(), &header.width, &header.height, &header.channels, 0);
+            if (img == nullptr) {
+                std::cerr << "Could not open or find the image " << filename << "." << std::endl;
+                return false;
+            }
+            std::vector<unsigned char> data(img, img + static_cast<size_t>(header.width) * header.height * header.channels);
+            stbi_image_free(img);
+            compressImage(std::move(data), header, options, &staged);
+        }
+        Histogram imageFreq = buildHistogram(staged);
+        for (int s = 0; s < 256; s++) freq[s] += imageFreq[s];
+    }
+    for (uint64_t& count : freq) count++;
+    CodeLengths trained = buildCodeLengths(freq, options.maxCodeLength);
+
+    uint32_t nextId = 1;
+    for (const PretrainedHuffmanTable* table = kPretrainedHuffmanTables; table->id != 0; table++) {
+        nextId = std::max(nextId, table->id + 1);
+    }
 
-    Node* root = nullptr;
-    std::map<char, std::string> huffmanCode;
-    buildHuffmanTree(data, root, huffmanCode);
+    std::ofstream out(options.tableFile);
+    if (!out) {
+        std::cerr << "Error opening " << options.tableFile << " for writing." << std::endl;
+        return false;
+    }
+    out << "// Pretrained static Huffman tables, generated by \"CompresorImagenesHuffman --train=<name> --table-file=<path>\".\n"
+           "// Files coded with --static-table=<id> store only the table ID, so the compressor\n"
+           "// and RecuperarImagenDatos must be built from the same registry. Do not edit by hand.\n"
+           "#ifndef TABLAS_HUFFMAN_H\n#define TABLAS_HUFFMAN_H\n\n#include <cstdint>\n\n"
+           "struct PretrainedHuffmanTable {\n"
+           "    uint32_t id;  // 0 ends the registry\n"
+           "    const char* name;\n"
+           "    unsigned char lengths[256];\n"
+           "};\n\n"
+           "static const PretrainedHuffmanTable kPretrainedHuffmanTables[] = {\n";
+    auto writeTable = [&](uint32_t id, const std::string& name, const unsigned char* lengths) {
+        out << "    {" << id << ", \"" << name << "\", {";
+        for (int s = 0; s < 256; s++) {
+            out << (s % 16 == 0 ? "\n        " : " ") << static_cast<int>(lengths[s]) << (s < 255 ? "," : "");
+        }
+        out << "\n    }},\n";
+    };
+    for (const PretrainedHuffmanTable* table = kPretrainedHuffmanTables; table->id != 0; table++) {
+        writeTable(table->id, table->name, table->lengths);
+    }
+    writeTable(nextId, options.trainName, trained.data());
+    out << "    {0, nullptr, {}}\n};\n\n"
+           "inline const PretrainedHuffmanTable* findPretrainedHuffmanTable(uint32_t id) {\n"
+           "    for (const PretrainedHuffmanTable* table = kPretrainedHuffmanTables; table->id != 0; table++) {\n"
+           "        if (table->id == id) return table;\n"
+           "    }\n"
+           "    return nullptr;\n"
+           "}\n\n#endif\n";
 
-    std::string encodedData = encode(data, huffmanCode);
+    std::cout << "Trained table " << nextId << " (\"" << options.trainName << "\") from "
+              << options.trainImages.size() << " images; rebuild both programs to use it." << std::endl;
+    return true;
+}
 
-    std::string serializedTree;
-    saveHuffmanTree(root, serializedTree);
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return -1;
+    }
+    if (!options.trainName.empty()) {
+        return trainStaticTable(options) ? 0 : -1;
+    }
 
-    // Compress the encoded data and serialized tree using zlib
-    uLongf compressedSize = compressBound(encodedData.size());
-    std::vector<char> compressedData(compressedSize);
-    compress(reinterpret_cast<Bytef*>(compressedData.data()), &compressedSize, reinterpret_cast<const Bytef*>(encodedData.data()), encodedData.size());
+    Patient patient;
+    getPatientData(patient);
 
-    uLongf compressedTreeSize = compressBound(serializedTree.size());
-    std::vector<char> compressedTree(compressedTreeSize);
-    compress(reinterpret_cast<Bytef*>(compressedTree.data()), &compressedTreeSize, reinterpret_cast<const Bytef*>(serializedTree.data()), serializedTree.size());
+    std::string filename;
+    std::cout << "Enter image filename (with .jpg extension): ";
+    std::cin >> filename;
 
     // Encrypt the compressed data and compressed tree using Hill cipher
     int key[2][2] = {{3, 3}, {2, 5}};
@@ -217,7 +3114,34 @@ int main() {
                               "Diagnosis: " + patient.diagnosis + "\n";
     std::string encryptedPatientData = hillCipher(patientData, key, mod);
 
-    saveToFile("compressed.pap", std::string(compressedData.begin(), compressedData.begin() + compressedSize), std::string(compressedTree.begin(), compressedTree.begin() + compressedTreeSize), encryptedPatientData, width, height, channels);
+    // stbi_load() would truncate 16-bit PNG/PNM sources, so those take their own path
+    bool wide = stbi_is_16_bit(filename.c_str());
+    if (options.codec == CODEC_STREAM && !wide) {
+        if (!streamToFile(filename, "compressed.pap", options, encryptedPatientData)) {
+            return -1;
+        }
+    } else {
+        PapHeader header;
+        CodedImage coded;
+        if (wide) {
+            std::vector<unsigned char> data;
+            if (!loadWideImage(filename, header, options, data)) {
+                std::cerr << "Could not open or find the image." << std::endl;
+                return -1;
+            }
+            coded = codeSmallest(options, [&](const Options& run) { return runCodec(data, header, run); });
+        } else {
+            unsigned char* img = stbi_load(filename.c_str(), &header.width, &header.height, &header.channels, 0);
+            if (img == nullptr) {
+                std::cerr << "Could not open or find the image." << std::endl;
+                return -1;
+            }
+            std::vector<unsigned char> data(img, img + static_cast<size_t>(header.width) * header.height * header.channels);
+            stbi_image_free(img);
+            coded = codeSmallest(options, [&](const Options& run) { return compressImage(data, header, run); });
+        }
+        saveToFile("compressed.pap", coded.header, coded.data, coded.tables, encryptedPatientData);
+    }
 
     std::cout << "Image and patient data compressed, encrypted, and saved as compressed.pap" << std::endl;
 
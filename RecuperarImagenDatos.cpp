@@ -6,9 +6,16 @@
 #include <zlib.h>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include "TablasHuffman.h"
 #include <string>
 #include <cctype>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <memory>
 
 using namespace std;
 
@@ -75,14 +82,6 @@ string hillDecipher(string text, int key[MATRIX_SIZE][MATRIX_SIZE], int mod) {
     return decryptedText;
 }
 
-struct Node {
-    char ch;
-    Node* left;
-    Node* right;
-
-    Node(char c) : ch(c), left(nullptr), right(nullptr) {}
-};
-
 struct Patient {
     string name;
     int age;
@@ -92,66 +91,1373 @@ struct Patient {
     string diagnosis;
 };
 
-Node* deserializeHuffmanTree(const string& str, int& index) {
-    if (index >= str.size()) return nullptr;
+// Bits de PapHeader::transforms: etapas reversibles que el compresor aplicó
+// antes de la codificación y que se deshacen en orden inverso
+const uint32_t TRANSFORM_FILTER = 1 << 0;
+const uint32_t TRANSFORM_COLOR = 1 << 1;
+const uint32_t TRANSFORM_PLANAR = 1 << 2;
+const uint32_t TRANSFORM_REDUCE = 1 << 3;
+const uint32_t TRANSFORM_PALETTE = 1 << 4;
+const uint32_t TRANSFORM_LOW_BITS = 1 << 5;
+const uint32_t TRANSFORM_WIDE = 1 << 6;
+
+// Códec con el que se generó la sección de datos (PapHeader::codec)
+enum Codec {
+    CODEC_HUFFMAN = 0,
+    CODEC_LOCO = 1,
+    CODEC_RANS = 2,
+    CODEC_FSE = 3,
+    CODEC_ARITH = 4,
+    CODEC_STATIC_HUFFMAN = 5,
+    CODEC_PAIRS = 6,
+    CODEC_BWT = 7,
+    CODEC_LZ = 8,
+    CODEC_RLE = 9,
+    CODEC_STREAM = 10
+};
+
+struct PapHeader {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    uint32_t codec = CODEC_HUFFMAN;
+    uint32_t transforms = 0;
+    string transformData;
+};
+
+// Filtros de predicción de PNG, en el mismo orden que en el compresor
+enum FilterType {
+    FILTER_NONE = 0,
+    FILTER_SUB,
+    FILTER_UP,
+    FILTER_AVERAGE,
+    FILTER_PAETH,
+    FILTER_COUNT
+};
+
+inline int paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// Deshace el filtro de una fila sobre la fila anterior ya reconstruida. Se
+// instancia por tipo de muestra (8 o 16 bits) y número de canales para que
+// el desplazamiento al vecino sea constante; con Channels == 0 se toma de
+// runtimeBpp. La suma se hace módulo el rango de la muestra, como en el
+// compresor.
+template <typename Sample, int Channels>
+bool unfilterRowKernel(unsigned char type, Sample* row, const Sample* prev, size_t rowSamples, size_t runtimeBpp) {
+    const size_t bpp = Channels > 0 ? Channels : runtimeBpp;
+    size_t i = 0;
+    switch (type) {
+    case FILTER_NONE:
+        break;
+    case FILTER_SUB:
+        for (i = bpp; i < rowSamples; i++) row[i] += row[i - bpp];
+        break;
+    case FILTER_UP:
+        for (; i < rowSamples; i++) row[i] += prev[i];
+        break;
+    case FILTER_AVERAGE:
+        for (; i < bpp && i < rowSamples; i++) row[i] += prev[i] >> 1;
+        for (; i < rowSamples; i++) row[i] += (row[i - bpp] + prev[i]) >> 1;
+        break;
+    case FILTER_PAETH:
+        for (; i < bpp && i < rowSamples; i++) row[i] += prev[i];
+        for (; i < rowSamples; i++) row[i] += paethPredictor(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+template <typename Sample>
+using UnfilterRowKernel = bool (*)(unsigned char, Sample*, const Sample*, size_t, size_t);
+
+template <typename Sample>
+UnfilterRowKernel<Sample> selectUnfilterRowKernel(int bpp) {
+    switch (bpp) {
+    case 1: return unfilterRowKernel<Sample, 1>;
+    case 2: return unfilterRowKernel<Sample, 2>;
+    case 3: return unfilterRowKernel<Sample, 3>;
+    case 4: return unfilterRowKernel<Sample, 4>;
+    default: return unfilterRowKernel<Sample, 0>;
+    }
+}
+
+// Deshace los filtros fila por fila: cada fila se reconstruye sobre la fila
+// anterior ya reconstruida, así que este paso es secuencial
+template <typename Sample>
+bool unfilterImage(vector<Sample>& data, int width, int height, int channels, const unsigned char* rowFilters) {
+    size_t rowSamples = static_cast<size_t>(width) * channels;
+    vector<Sample> zeroRow(rowSamples, 0);
+    UnfilterRowKernel<Sample> unfilterRow = selectUnfilterRowKernel<Sample>(channels);
+    for (int y = 0; y < height; y++) {
+        Sample* row = &data[y * rowSamples];
+        const Sample* prev = y > 0 ? row - rowSamples : zeroRow.data();
+        if (!unfilterRow(rowFilters[y], row, prev, rowSamples, channels)) return false;
+    }
+    return true;
+}
+
+const int MAX_CODE_LENGTH = 15;
+
+// Tabla de decodificación de un solo nivel: indexada con los siguientes
+// `bits` bits del flujo, da el símbolo y cuántos bits ocupa su código
+struct DecodeEntry {
+    unsigned char symbol;
+    unsigned char length;
+};
+
+struct DecodeTable {
+    int bits = 0;
+    vector<DecodeEntry> entries;
+};
+
+// Reconstruye los códigos canónicos a partir de 256 longitudes guardadas
+// en el .pap (mismo orden que el compresor) y llena la tabla de búsqueda
+bool buildDecodeTable(const unsigned char* codeLengths, DecodeTable& table) {
+    int lengthCount[MAX_CODE_LENGTH + 1] = {};
+    int maxLength = 0;
+    for (int s = 0; s < 256; s++) {
+        int len = codeLengths[s];
+        if (len > MAX_CODE_LENGTH) return false;
+        lengthCount[len]++;
+        maxLength = max(maxLength, len);
+    }
+    lengthCount[0] = 0;
+    if (maxLength == 0) return false;
+
+    // Verificar la desigualdad de Kraft para no desbordar la tabla con un archivo corrupto
+    uint64_t kraft = 0;
+    for (int len = 1; len <= maxLength; len++) {
+        kraft += static_cast<uint64_t>(lengthCount[len]) << (maxLength - len);
+    }
+    if (kraft > (1ULL << maxLength)) return false;
+
+    uint32_t nextCode[MAX_CODE_LENGTH + 2] = {};
+    uint32_t code = 0;
+    for (int len = 1; len <= MAX_CODE_LENGTH; len++) {
+        code = (code + lengthCount[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+
+    table.bits = maxLength;
+    table.entries.assign(size_t(1) << maxLength, DecodeEntry{0, 0});
+    for (int s = 0; s < 256; s++) {
+        int len = codeLengths[s];
+        if (len == 0) continue;
+        uint32_t first = nextCode[len]++ << (maxLength - len);
+        uint32_t span = 1u << (maxLength - len);
+        for (uint32_t i = 0; i < span; i++) {
+            table.entries[first + i] = DecodeEntry{static_cast<unsigned char>(s), static_cast<unsigned char>(len)};
+        }
+    }
+    return true;
+}
+
+// Modo multi-tabla: cada grupo de TABLE_GROUP_SIZE bytes de un bloque usa la
+// tabla indicada por su selector (un byte por grupo al inicio del bloque)
+const int MAX_TABLES = 6;
+const size_t TABLE_GROUP_SIZE = 1024;
+
+bool buildDecodeTables(const vector<unsigned char>& codeLengths, vector<DecodeTable>& tables) {
+    size_t tableCount = codeLengths.size() / 256;
+    if (tableCount == 0 || tableCount > MAX_TABLES || codeLengths.size() % 256 != 0) return false;
+    tables.resize(tableCount);
+    for (size_t t = 0; t < tableCount; t++) {
+        if (!buildDecodeTable(&codeLengths[t * 256], tables[t])) return false;
+    }
+    return true;
+}
+
+// Lector de bits MSB-first sobre el flujo empaquetado por BitWriter en el compresor.
+// Los bits pendientes quedan alineados a la izquierda en `buf`.
+struct BitReader {
+    const unsigned char* data;
+    size_t size;
+    size_t pos = 0;
+    uint64_t buf = 0;
+    int count = 0;
+
+    BitReader(const unsigned char* d, size_t n) : data(d), size(n) {}
+
+    void refill() {
+        while (count <= 56) {
+            uint64_t byte = pos < size ? data[pos++] : 0;
+            buf |= byte << (56 - count);
+            count += 8;
+        }
+    }
+
+    // Devuelve los siguientes n bits (n <= 56) sin consumirlos
+    uint32_t peek(int n) {
+        if (count < n) refill();
+        return static_cast<uint32_t>(buf >> (64 - n));
+    }
+
+    void consume(int n) {
+        buf <<= n;
+        count -= n;
+    }
+
+    uint32_t read(int n) {
+        uint32_t value = peek(n);
+        consume(n);
+        return value;
+    }
+
+    // Cuenta los ceros hasta el siguiente 1 (como máximo 24) y consume también ese 1
+    int readZeros() {
+        uint32_t window = peek(24);
+        if (window == 0) {
+            consume(24);
+            return 24;
+        }
+        int zeros = 0;
+        while (!(window & (1u << (23 - zeros)))) zeros++;
+        consume(zeros + 1);
+        return zeros;
+    }
+};
+
+// Decodifica exactamente symbolCount símbolos en out; el relleno del último byte se ignora
+void decode(const DecodeTable& table, const unsigned char* encoded, size_t size, unsigned char* out, size_t symbolCount) {
+    BitReader reader(encoded, size);
+    for (size_t i = 0; i < symbolCount; i++) {
+        const DecodeEntry& entry = table.entries[reader.peek(table.bits)];
+        out[i] = entry.symbol;
+        reader.consume(entry.length);
+    }
+}
+
+// Ejecuta body(i) para cada i en [0, count) usando hasta hardware_concurrency() hilos
+void parallelFor(size_t count, const function<void(size_t)>& body) {
+    size_t workers = min<size_t>(count, max(1u, thread::hardware_concurrency()));
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++) body(i);
+        return;
+    }
+
+    atomic<size_t> next(0);
+    vector<thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        threads.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) body(i);
+        });
+    }
+    for (thread& t : threads) t.join();
+}
+
+// Decodifica un bloque: recibe sus bytes comprimidos y escribe `count` bytes en out
+typedef function<bool(const unsigned char*, size_t, unsigned char*, size_t)> ChunkDecoder;
+
+bool readU32(const string& data, size_t& pos, uint32_t& value) {
+    if (pos + sizeof(value) > data.size()) return false;
+    memcpy(&value, data.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+// Recorre la tabla de offsets de bloques escrita por packChunks() en el compresor
+// y decodifica los bloques en paralelo, cada uno en su posición de out
+bool unpackChunks(const string& packed, vector<unsigned char>& out, const ChunkDecoder& decodeChunk) {
+    size_t pos = 0;
+    uint32_t chunkSize, chunkCount;
+    if (!readU32(packed, pos, chunkSize) || !readU32(packed, pos, chunkCount)) return false;
+    if (chunkSize == 0 || chunkCount != (out.size() + chunkSize - 1) / chunkSize) return false;
+
+    vector<uint32_t> offsets(chunkCount + 1);
+    for (uint32_t& offset : offsets) {
+        if (!readU32(packed, pos, offset)) return false;
+    }
+    for (uint32_t i = 0; i < chunkCount; i++) {
+        if (offsets[i] > offsets[i + 1]) return false;
+    }
+    if (pos + offsets[chunkCount] > packed.size()) return false;
+
+    const unsigned char* payload = reinterpret_cast<const unsigned char*>(packed.data()) + pos;
+    atomic<bool> ok(true);
+    parallelFor(chunkCount, [&](size_t i) {
+        size_t begin = i * static_cast<size_t>(chunkSize);
+        size_t count = min<size_t>(chunkSize, out.size() - begin);
+        if (!decodeChunk(payload + offsets[i], offsets[i + 1] - offsets[i], out.data() + begin, count)) {
+            ok = false;
+        }
+    });
+    return ok;
+}
+
+// Descomprime un bloque con zlib y decodifica sus códigos Huffman. Cada símbolo
+// ocupa como máximo `bits` bits de su tabla, lo que acota el tamaño descomprimido.
+// Con varias tablas el bloque empieza con un selector por grupo.
+bool inflateAndDecode(const vector<DecodeTable>& tables, const unsigned char* compressed, size_t size, unsigned char* out, size_t count) {
+    int maxBits = 0;
+    for (const DecodeTable& table : tables) maxBits = max(maxBits, table.bits);
+    size_t groupCount = tables.size() > 1 ? (count + TABLE_GROUP_SIZE - 1) / TABLE_GROUP_SIZE : 0;
+
+    uLongf encodedSize = groupCount + (count * maxBits + 7) / 8;
+    vector<unsigned char> encoded(encodedSize);
+    int res = uncompress(encoded.data(), &encodedSize, compressed, size);
+    if (res != Z_OK || encodedSize < groupCount) {
+        cerr << "Error descomprimiendo los datos: " << res << endl;
+        return false;
+    }
+
+    if (groupCount == 0) {
+        decode(tables[0], encoded.data(), encodedSize, out, count);
+        return true;
+    }
+
+    const unsigned char* selectors = encoded.data();
+    BitReader reader(encoded.data() + groupCount, encodedSize - groupCount);
+    for (size_t g = 0; g < groupCount; g++) {
+        if (selectors[g] >= tables.size()) return false;
+        const DecodeTable& table = tables[selectors[g]];
+        size_t end = min(count, (g + 1) * TABLE_GROUP_SIZE);
+        for (size_t i = g * TABLE_GROUP_SIZE; i < end; i++) {
+            const DecodeEntry& entry = table.entries[reader.peek(table.bits)];
+            out[i] = entry.symbol;
+            reader.consume(entry.length);
+        }
+    }
+    return true;
+}
+
+// Alfabeto extendido: cada par de bytes es un símbolo de 16 bits con código de
+// hasta PAIR_MAX_CODE_LENGTH bits. Los códigos cortos se resuelven con una tabla
+// de PAIR_LOOKUP_BITS bits; los largos, recorriendo los códigos canónicos por longitud.
+const size_t PAIR_SYMBOLS = 1 << 16;
+const int PAIR_MAX_CODE_LENGTH = 20;
+const int PAIR_LOOKUP_BITS = 12;
+
+struct PairDecodeTable {
+    int maxLength = 0;
+    vector<uint32_t> lookup;  // símbolo << 8 | longitud; longitud 0 si el código es más largo
+    uint32_t firstCode[PAIR_MAX_CODE_LENGTH + 1] = {};
+    uint32_t count[PAIR_MAX_CODE_LENGTH + 1] = {};
+    uint32_t firstIndex[PAIR_MAX_CODE_LENGTH + 1] = {};
+    vector<uint16_t> sorted;  // símbolos en orden canónico
+};
+
+// Las 65536 longitudes vienen comprimidas con zlib
+bool buildPairDecodeTable(const vector<unsigned char>& stored, PairDecodeTable& table) {
+    vector<unsigned char> lengths(PAIR_SYMBOLS);
+    uLongf size = PAIR_SYMBOLS;
+    if (uncompress(lengths.data(), &size, stored.data(), stored.size()) != Z_OK || size != PAIR_SYMBOLS) return false;
+
+    for (unsigned char len : lengths) {
+        if (len > PAIR_MAX_CODE_LENGTH) return false;
+        table.count[len]++;
+        table.maxLength = max<int>(table.maxLength, len);
+    }
+    table.count[0] = 0;
+    if (table.maxLength == 0) return false;
+
+    uint64_t kraft = 0;
+    for (int len = 1; len <= table.maxLength; len++) {
+        kraft += static_cast<uint64_t>(table.count[len]) << (table.maxLength - len);
+    }
+    if (kraft > (1ULL << table.maxLength)) return false;
+
+    uint32_t code = 0, index = 0;
+    for (int len = 1; len <= PAIR_MAX_CODE_LENGTH; len++) {
+        code = (code + table.count[len - 1]) << 1;
+        table.firstCode[len] = code;
+        table.firstIndex[len] = index;
+        index += table.count[len];
+    }
+
+    table.sorted.resize(index);
+    uint32_t next[PAIR_MAX_CODE_LENGTH + 1];
+    memcpy(next, table.firstIndex, sizeof(next));
+    table.lookup.assign(size_t(1) << PAIR_LOOKUP_BITS, 0);
+    for (size_t s = 0; s < PAIR_SYMBOLS; s++) {
+        int len = lengths[s];
+        if (len == 0) continue;
+        uint32_t position = next[len]++;
+        table.sorted[position] = static_cast<uint16_t>(s);
+        if (len > PAIR_LOOKUP_BITS) continue;
+        uint32_t first = (table.firstCode[len] + position - table.firstIndex[len]) << (PAIR_LOOKUP_BITS - len);
+        fill(table.lookup.begin() + first, table.lookup.begin() + first + (1u << (PAIR_LOOKUP_BITS - len)),
+             static_cast<uint32_t>(s << 8 | len));
+    }
+    return true;
+}
+
+// Devuelve el siguiente par, o -1 si los bits no forman un código válido
+inline int decodePair(BitReader& reader, const PairDecodeTable& table) {
+    uint32_t entry = table.lookup[reader.peek(PAIR_LOOKUP_BITS)];
+    if (entry & 0xFF) {
+        reader.consume(entry & 0xFF);
+        return static_cast<int>(entry >> 8);
+    }
+    uint32_t window = reader.peek(PAIR_MAX_CODE_LENGTH);
+    for (int len = PAIR_LOOKUP_BITS + 1; len <= table.maxLength; len++) {
+        uint32_t offset = (window >> (PAIR_MAX_CODE_LENGTH - len)) - table.firstCode[len];
+        if (offset < table.count[len]) {
+            reader.consume(len);
+            return table.sorted[table.firstIndex[len] + offset];
+        }
+    }
+    return -1;
+}
+
+bool inflateAndDecodePairs(const PairDecodeTable& table, const unsigned char* compressed, size_t size, unsigned char* out, size_t count) {
+    size_t pairs = (count + 1) / 2;
+    uLongf encodedSize = (pairs * table.maxLength + 7) / 8;
+    vector<unsigned char> encoded(encodedSize);
+    int res = uncompress(encoded.data(), &encodedSize, compressed, size);
+    if (res != Z_OK) {
+        cerr << "Error descomprimiendo los datos: " << res << endl;
+        return false;
+    }
+
+    BitReader reader(encoded.data(), encodedSize);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        int pair = decodePair(reader, table);
+        if (pair < 0) return false;
+        out[i] = static_cast<unsigned char>(pair >> 8);
+        out[i + 1] = static_cast<unsigned char>(pair);
+    }
+    if (i < count) {
+        int pair = decodePair(reader, table);
+        if (pair < 0) return false;
+        out[i] = static_cast<unsigned char>(pair >> 8);
+    }
+    return true;
+}
+
+// Modo de ordenación por bloques: cada bloque trae su fila primaria y cuántos
+// símbolos tiene, luego sus códigos Huffman. Se deshacen en orden la
+// codificación de ceros (RUNA/RUNB), el move-to-front y la BWT.
+bool decodeBwtBlock(const DecodeTable& table, const unsigned char* encoded, size_t size, unsigned char* out, size_t count) {
+    uint32_t prefix[2];
+    if (size < sizeof(prefix)) return false;
+    memcpy(prefix, encoded, sizeof(prefix));
+    uint32_t primary = prefix[0], symbolCount = prefix[1];
+    if (primary > count || symbolCount > 2 * count) return false;
+
+    vector<unsigned char> symbols(symbolCount);
+    decode(table, encoded + sizeof(prefix), size - sizeof(prefix), symbols.data(), symbolCount);
+
+    // Ceros en base 2 biyectiva e índices MTF desplazados en uno
+    vector<unsigned char> last(count);
+    unsigned char order[256];
+    for (int c = 0; c < 256; c++) order[c] = static_cast<unsigned char>(c);
+    size_t pos = 0, run = 0, runWeight = 1;
+    for (size_t i = 0; i < symbolCount; i++) {
+        unsigned char symbol = symbols[i];
+        if (symbol <= 1) {
+            run += runWeight * (symbol + 1);
+            runWeight *= 2;
+            if (run > count) return false;
+            continue;
+        }
+        if (run > count - pos) return false;
+        memset(&last[pos], order[0], run);
+        pos += run;
+        run = 0;
+        runWeight = 1;
+
+        int index = symbol - 1;
+        if (symbol == 255) {
+            if (++i >= symbolCount || symbols[i] > 1) return false;
+            index = 254 + symbols[i];
+        }
+        if (pos >= count) return false;
+        unsigned char c = order[index];
+        memmove(order + 1, order, index);
+        order[0] = c;
+        last[pos++] = c;
+    }
+    if (run != count - pos) return false;
+    memset(&last[pos], order[0], run);
+
+    // BWT inversa: la última columna sin el centinela, que estaba en la fila
+    // `primary`; LF lleva cada fila a la de la rotación anterior
+    uint32_t start[256];
+    uint32_t sum = 1;
+    size_t histogram[256] = {};
+    for (unsigned char c : last) histogram[c]++;
+    for (int c = 0; c < 256; c++) {
+        start[c] = sum;
+        sum += static_cast<uint32_t>(histogram[c]);
+    }
+    vector<uint32_t> lf(count + 1);
+    for (size_t row = 0, i = 0; row <= count; row++) {
+        if (row == primary) {
+            lf[row] = 0;
+            continue;
+        }
+        lf[row] = start[last[i++]]++;
+    }
+    uint32_t row = 0;
+    for (size_t k = count; k > 0; k--) {
+        if (row == primary) return false;
+        out[k - 1] = last[row < primary ? row : row - 1];
+        row = lf[row];
+    }
+    return true;
+}
+
+// LZ 2-D: cada bloque es una franja de filas con el número de literales y de
+// secuencias, los cuatro flujos Huffman seguidos y al final los bits extra de
+// cada secuencia (corrida, longitud, distancia). Las distancias por debajo de
+// LZ_DISTANCE_BASE son relativas al ancho de fila.
+const int LZ_STREAMS = 4;
+const int LZ_MIN_MATCH = 3;
+const int LZ_DISTANCE_BASE = 6;
+
+enum LzStream { LZ_LITERALS = 0, LZ_RUNS, LZ_LENGTHS, LZ_DISTANCES };
+
+// Inverso de lzValue(): los símbolos desde 16 llevan los dos bits altos
+inline bool readLzValue(BitReader& reader, unsigned char symbol, uint32_t& value) {
+    if (symbol < 16) {
+        value = symbol;
+        return true;
+    }
+    int top = (symbol - 16) / 2 + 4;
+    if (top > 31) return false;
+    value = (static_cast<uint32_t>(2 | ((symbol - 16) & 1)) << (top - 1)) | reader.read(top - 1);
+    return true;
+}
+
+bool decodeLzStripe(const vector<DecodeTable>& tables, const unsigned char* encoded, size_t size, unsigned char* out, size_t count, size_t stride, size_t channels) {
+    uint32_t counts[2];
+    if (size < sizeof(counts)) return false;
+    memcpy(counts, encoded, sizeof(counts));
+    uint32_t literalCount = counts[0], sequenceCount = counts[1];
+    if (literalCount > count || sequenceCount > count / LZ_MIN_MATCH) return false;
+
+    vector<unsigned char> streams[LZ_STREAMS];
+    BitReader reader(encoded + sizeof(counts), size - sizeof(counts));
+    for (int stream = 0; stream < LZ_STREAMS; stream++) {
+        const DecodeTable& table = tables[stream];
+        streams[stream].resize(stream == LZ_LITERALS ? literalCount : sequenceCount);
+        for (unsigned char& symbol : streams[stream]) {
+            const DecodeEntry& entry = table.entries[reader.peek(table.bits)];
+            symbol = entry.symbol;
+            reader.consume(entry.length);
+        }
+    }
+
+    const size_t special[LZ_DISTANCE_BASE] = {0, stride, channels, stride + channels, stride - channels, 2 * stride};
+    const unsigned char* literals = streams[LZ_LITERALS].data();
+    size_t pos = 0, literal = 0, lastDistance = stride;
+    for (uint32_t i = 0; i < sequenceCount; i++) {
+        uint32_t run, length, distance;
+        unsigned char code = streams[LZ_DISTANCES][i];
+        if (!readLzValue(reader, streams[LZ_RUNS][i], run) || !readLzValue(reader, streams[LZ_LENGTHS][i], length)) return false;
+        if (code >= LZ_DISTANCE_BASE) {
+            if (!readLzValue(reader, code - LZ_DISTANCE_BASE, distance)) return false;
+            distance++;
+        } else {
+            distance = static_cast<uint32_t>(code == 0 ? lastDistance : special[code]);
+        }
+        length += LZ_MIN_MATCH;
+
+        if (run > literalCount - literal || run > count - pos) return false;
+        memcpy(out + pos, literals + literal, run);
+        pos += run;
+        literal += run;
+        if (distance == 0 || distance > pos || length > count - pos) return false;
+        // Copia byte a byte: la fuente puede solaparse con el destino
+        for (uint32_t k = 0; k < length; k++, pos++) out[pos] = out[pos - distance];
+        lastDistance = distance;
+    }
+    if (literalCount - literal != count - pos) return false;
+    memcpy(out + pos, literals + literal, count - pos);
+    return true;
+}
+
+// Prepaso de corridas: el bloque descomprimido empieza con el número de
+// corridas y una ficha (literales previos, longitud, valor) por corrida; los
+// literales se decodifican en su sitio y las corridas se llenan con memset
+const size_t MIN_RUN = 32;
+const size_t RUN_TOKEN_SIZE = 2 * sizeof(uint32_t) + 1;
+
+bool inflateAndExpandRuns(const DecodeTable& table, const unsigned char* compressed, size_t size, unsigned char* out, size_t count) {
+    uLongf encodedSize = sizeof(uint32_t) + (count / MIN_RUN) * RUN_TOKEN_SIZE + (count * table.bits + 7) / 8;
+    vector<unsigned char> encoded(encodedSize);
+    int res = uncompress(encoded.data(), &encodedSize, compressed, size);
+    uint32_t runCount = 0;
+    if (res != Z_OK || encodedSize < sizeof(runCount)) {
+        cerr << "Error descomprimiendo los datos: " << res << endl;
+        return false;
+    }
+    memcpy(&runCount, encoded.data(), sizeof(runCount));
+    size_t tokensEnd = sizeof(runCount) + static_cast<size_t>(runCount) * RUN_TOKEN_SIZE;
+    if (runCount > count / MIN_RUN || tokensEnd > encodedSize) return false;
+
+    BitReader reader(encoded.data() + tokensEnd, encodedSize - tokensEnd);
+    auto decodeLiterals = [&](unsigned char* dest, size_t literals) {
+        for (size_t i = 0; i < literals; i++) {
+            const DecodeEntry& entry = table.entries[reader.peek(table.bits)];
+            dest[i] = entry.symbol;
+            reader.consume(entry.length);
+        }
+    };
+
+    size_t pos = 0;
+    const unsigned char* token = encoded.data() + sizeof(runCount);
+    for (uint32_t r = 0; r < runCount; r++, token += RUN_TOKEN_SIZE) {
+        uint32_t lengths[2];
+        memcpy(lengths, token, sizeof(lengths));
+        if (lengths[0] > count - pos || lengths[1] > count - pos - lengths[0]) return false;
+        decodeLiterals(out + pos, lengths[0]);
+        pos += lengths[0];
+        memset(out + pos, token[sizeof(lengths)], lengths[1]);
+        pos += lengths[1];
+    }
+    decodeLiterals(out + pos, count - pos);
+    return true;
+}
+
+// Modo en flujo: un único flujo zlib con los bits fila por fila. Empieza con la tabla
+// inicial (256 longitudes de 4 bits); cada fila trae su filtro en
+// STREAM_FILTER_BITS bits seguido de sus códigos, y se reconstruye sobre la
+// anterior en cuanto se decodifica. Cada vez que se completan STREAM_SEGMENT
+// bytes (al final de una fila) viene un bit que indica si sigue una tabla
+// nueva o si se mantiene la actual.
+const size_t STREAM_SEGMENT = 1 << 16;
+const int STREAM_LENGTH_BITS = 4;
+const int STREAM_FILTER_BITS = 3;
+
+bool readStreamTable(BitReader& reader, DecodeTable& table) {
+    unsigned char lengths[256];
+    for (unsigned char& len : lengths) len = static_cast<unsigned char>(reader.read(STREAM_LENGTH_BITS));
+    return buildDecodeTable(lengths, table);
+}
+
+bool inflateAndDecodeStream(const unsigned char* compressed, size_t size, vector<unsigned char>& out, int width, int channels) {
+    size_t rowBytes = static_cast<size_t>(width) * channels;
+    if (rowBytes == 0) return out.empty();
+    size_t rows = out.size() / rowBytes;
+    size_t tables = out.size() / STREAM_SEGMENT + 1;
+    uLongf encodedSize = (tables * (1 + 256 * STREAM_LENGTH_BITS) + rows * STREAM_FILTER_BITS + out.size() * MAX_CODE_LENGTH + 7) / 8;
+    vector<unsigned char> encoded(encodedSize);
+    int res = uncompress(encoded.data(), &encodedSize, compressed, size);
+    if (res != Z_OK) {
+        cerr << "Error descomprimiendo los datos: " << res << endl;
+        return false;
+    }
+    vector<unsigned char> zeroRow(rowBytes, 0);
+    UnfilterRowKernel<unsigned char> unfilterRow = selectUnfilterRowKernel<unsigned char>(channels);
+
+    BitReader reader(encoded.data(), encodedSize);
+    DecodeTable table;
+    if (!readStreamTable(reader, table)) return false;
+    size_t windowBytes = 0;
+    for (size_t pos = 0; pos < out.size(); pos += rowBytes) {
+        unsigned char type = static_cast<unsigned char>(reader.read(STREAM_FILTER_BITS));
+        unsigned char* row = &out[pos];
+        for (size_t i = 0; i < rowBytes; i++) {
+            const DecodeEntry& entry = table.entries[reader.peek(table.bits)];
+            row[i] = entry.symbol;
+            reader.consume(entry.length);
+        }
+        const unsigned char* prev = pos > 0 ? row - rowBytes : zeroRow.data();
+        if (!unfilterRow(type, row, prev, rowBytes, channels)) return false;
+
+        windowBytes += rowBytes;
+        if (windowBytes >= STREAM_SEGMENT) {
+            windowBytes = 0;
+            if (reader.read(1) && !readStreamTable(reader, table)) return false;
+        }
+    }
+    return true;
+}
+
+// Códec LOCO-I (JPEG-LS, ITU-T T.87) sin pérdida para muestras de 8 bits. Debe
+// coincidir exactamente con el compresor: cada bloque es una franja de filas
+// completas que se decodifica desde cero, un componente tras otro.
+const int LOCO_RANGE = 256;
+const int LOCO_QBPP = 8;
+const int LOCO_LIMIT = 32;
+const int LOCO_RESET = 64;
+const int LOCO_T1 = 3;
+const int LOCO_T2 = 7;
+const int LOCO_T3 = 21;
+const int LOCO_CONTEXTS = 365;
+const int LOCO_J[32] = {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                        4, 4, 5, 5, 6, 6, 7, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+struct LocoContext {
+    int A = 4;
+    int B = 0;
+    int C = 0;
+    int N = 1;
+};
+
+struct LocoRunContext {
+    int A = 4;
+    int N = 1;
+    int Nn = 0;
+};
+
+struct LocoState {
+    LocoContext regular[LOCO_CONTEXTS];
+    LocoRunContext run[2];
+    int runIndex = 0;
+};
+
+inline int locoQuantize(int d) {
+    if (d <= -LOCO_T3) return -4;
+    if (d <= -LOCO_T2) return -3;
+    if (d <= -LOCO_T1) return -2;
+    if (d < 0) return -1;
+    if (d == 0) return 0;
+    if (d < LOCO_T1) return 1;
+    if (d < LOCO_T2) return 2;
+    if (d < LOCO_T3) return 3;
+    return 4;
+}
+
+inline int locoMedPredict(int a, int b, int c) {
+    if (c >= max(a, b)) return min(a, b);
+    if (c <= min(a, b)) return max(a, b);
+    return a + b - c;
+}
+
+inline int locoReduce(int e) {
+    if (e < -LOCO_RANGE / 2) return e + LOCO_RANGE;
+    if (e >= LOCO_RANGE / 2) return e - LOCO_RANGE;
+    return e;
+}
+
+int locoGetGolomb(BitReader& reader, int k, int limit) {
+    int high = reader.readZeros();
+    if (high >= limit - LOCO_QBPP - 1) {
+        return static_cast<int>(reader.read(LOCO_QBPP)) + 1;
+    }
+    if (k == 0) return high;
+    return (high << k) | static_cast<int>(reader.read(k));
+}
+
+void locoUpdate(LocoContext& ctx, int err) {
+    int a = ctx.A + abs(err);
+    int b = ctx.B + err;
+    int n = ctx.N;
+    if (n == LOCO_RESET) {
+        a >>= 1;
+        b = b >= 0 ? b >> 1 : -((1 - b) >> 1);
+        n >>= 1;
+    }
+    ctx.A = a;
+    n++;
+    ctx.N = n;
+    if (b + n <= 0) {
+        b += n;
+        if (b <= -n) b = -n + 1;
+        if (ctx.C > -128) ctx.C--;
+    } else if (b > 0) {
+        b -= n;
+        if (b > 0) b = 0;
+        if (ctx.C < 127) ctx.C++;
+    }
+    ctx.B = b;
+}
+
+int locoDecodeRegular(BitReader& reader, LocoState& state, int q, int a, int b, int c) {
+    int sign = 1;
+    if (q < 0) {
+        q = -q;
+        sign = -1;
+    }
+    LocoContext& ctx = state.regular[q];
+    int px = min(255, max(0, locoMedPredict(a, b, c) + sign * ctx.C));
+
+    int k = 0;
+    while ((ctx.N << k) < ctx.A) k++;
+    int mapped = locoGetGolomb(reader, k, LOCO_LIMIT);
+    int e = (mapped & 1) ? -((mapped + 1) >> 1) : mapped >> 1;
+    int err = (k == 0 && 2 * ctx.B + ctx.N - 1 < 0) ? -e - 1 : e;
+    locoUpdate(ctx, err);
+    return (px + sign * err) & (LOCO_RANGE - 1);
+}
+
+int locoDecodeInterruption(BitReader& reader, LocoState& state, int ra, int rb) {
+    int type = ra == rb ? 1 : 0;
+    LocoRunContext& ctx = state.run[type];
+
+    int temp = ctx.A + (ctx.N >> 1) * type;
+    int k = 0;
+    for (int n = ctx.N; n < temp; n <<= 1) k++;
+    int mapped = locoGetGolomb(reader, k, LOCO_LIMIT - LOCO_J[state.runIndex] - 1);
+    int t = mapped + type;
+    int map = t & 1;
+    int absErr = (t + map) / 2;
+    int err = ((k != 0 || 2 * ctx.Nn >= ctx.N) == (map != 0)) ? -absErr : absErr;
+
+    if (err < 0) ctx.Nn++;
+    ctx.A += (mapped + 1 - type) >> 1;
+    if (ctx.N == LOCO_RESET) {
+        ctx.A >>= 1;
+        ctx.N >>= 1;
+        ctx.Nn >>= 1;
+    }
+    ctx.N++;
+
+    if (type) return (ra + err) & (LOCO_RANGE - 1);
+    return (rb + err * (rb >= ra ? 1 : -1)) & (LOCO_RANGE - 1);
+}
+
+// Decodifica una corrida de muestras iguales a la izquierda desde x y, si
+// termina antes del final de la fila, la muestra que la interrumpe
+int locoDecodeRun(BitReader& reader, LocoState& state, int* cur, const int* prev, int x, int width) {
+    int ra = cur[x];
+    int pixelCount = width - x;
+    int index = 0;
+    while (reader.read(1)) {
+        int count = min(1 << LOCO_J[state.runIndex], pixelCount - index);
+        index += count;
+        if (count == (1 << LOCO_J[state.runIndex]) && state.runIndex < 31) state.runIndex++;
+        if (index == pixelCount) break;
+    }
+    if (index != pixelCount && LOCO_J[state.runIndex] > 0) {
+        index = min(pixelCount, index + static_cast<int>(reader.read(LOCO_J[state.runIndex])));
+    }
+    for (int i = 0; i < index; i++) cur[x + i + 1] = ra;
+    if (index == pixelCount) return index;
+
+    int end = x + index;
+    cur[end + 1] = locoDecodeInterruption(reader, state, ra, prev[end + 1]);
+    if (state.runIndex > 0) state.runIndex--;
+    return index + 1;
+}
+
+bool decodeLocoStripe(const unsigned char* encoded, size_t size, unsigned char* out, size_t count, int width, int channels) {
+    size_t rowBytes = static_cast<size_t>(width) * channels;
+    if (count % rowBytes != 0) return false;
+    int rows = static_cast<int>(count / rowBytes);
+    BitReader reader(encoded, size);
+
+    for (int comp = 0; comp < channels; comp++) {
+        LocoState state;
+        vector<int> prevLine(width + 2, 0), curLine(width + 2, 0);
+        for (int y = 0; y < rows; y++) {
+            curLine[0] = prevLine[1];
+            prevLine[width + 1] = prevLine[width];
+            int* cur = curLine.data();
+            const int* prev = prevLine.data();
+
+            int x = 0;
+            while (x < width) {
+                int a = cur[x], b = prev[x + 1], c = prev[x], d = prev[x + 2];
+                int q = (locoQuantize(d - b) * 9 + locoQuantize(b - c)) * 9 + locoQuantize(c - a);
+                if (q == 0) {
+                    x += locoDecodeRun(reader, state, cur, prev, x, width);
+                } else {
+                    cur[x + 1] = locoDecodeRegular(reader, state, q, a, b, c);
+                    x++;
+                }
+            }
+
+            unsigned char* row = out + y * rowBytes + comp;
+            for (int i = 0; i < width; i++) row[i * channels] = static_cast<unsigned char>(cur[i + 1]);
+            swap(prevLine, curLine);
+        }
+    }
+    return true;
+}
+
+// rANS entrelazado (variante por bytes de ryg_rans), espejo del compresor:
+// estados de 32 bits en [2^23, 2^31) y el símbolo i usa el estado i % RANS_STATES
+const int RANS_SCALE_BITS = 14;
+const uint32_t RANS_LOWER_BOUND = 1u << 23;
+const int RANS_STATES = 4;
+
+struct RansDecodeTable {
+    uint32_t freq[256];
+    uint32_t start[256];
+    vector<unsigned char> slotSymbol; // símbolo de cada una de las 2^RANS_SCALE_BITS ranuras
+};
+
+// Lee las 256 frecuencias normalizadas (16 bits cada una); deben sumar 2^RANS_SCALE_BITS
+bool buildRansDecodeTable(const vector<unsigned char>& tables, RansDecodeTable& table) {
+    if (tables.size() != 256 * sizeof(uint16_t)) return false;
+    table.slotSymbol.resize(size_t(1) << RANS_SCALE_BITS);
+    uint32_t start = 0;
+    for (int s = 0; s < 256; s++) {
+        uint16_t freq;
+        memcpy(&freq, &tables[s * sizeof(uint16_t)], sizeof(freq));
+        if (start + freq > (1u << RANS_SCALE_BITS)) return false;
+        table.freq[s] = freq;
+        table.start[s] = start;
+        fill(table.slotSymbol.begin() + start, table.slotSymbol.begin() + start + freq, static_cast<unsigned char>(s));
+        start += freq;
+    }
+    return start == (1u << RANS_SCALE_BITS);
+}
+
+inline unsigned char ransDecodeOne(uint32_t& x, const RansDecodeTable& table, const unsigned char*& ptr, const unsigned char* end) {
+    const uint32_t mask = (1u << RANS_SCALE_BITS) - 1;
+    unsigned char s = table.slotSymbol[x & mask];
+    x = table.freq[s] * (x >> RANS_SCALE_BITS) + (x & mask) - table.start[s];
+    while (x < RANS_LOWER_BOUND) {
+        x = (x << 8) | (ptr < end ? *ptr++ : 0);
+    }
+    return s;
+}
+
+bool decodeRans(const RansDecodeTable& table, const unsigned char* in, size_t size, unsigned char* out, size_t count) {
+    if (size < 4 * RANS_STATES) return false;
+    const unsigned char* ptr = in;
+    const unsigned char* end = in + size;
+    uint32_t state[RANS_STATES];
+    for (int s = 0; s < RANS_STATES; s++) {
+        state[s] = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+        ptr += 4;
+    }
+
+    // Desenrollado por estados: las cuatro cadenas de dependencias avanzan a la vez
+    size_t i = 0;
+    for (; i + RANS_STATES <= count; i += RANS_STATES) {
+        out[i] = ransDecodeOne(state[0], table, ptr, end);
+        out[i + 1] = ransDecodeOne(state[1], table, ptr, end);
+        out[i + 2] = ransDecodeOne(state[2], table, ptr, end);
+        out[i + 3] = ransDecodeOne(state[3], table, ptr, end);
+    }
+    for (; i < count; i++) {
+        out[i] = ransDecodeOne(state[i % RANS_STATES], table, ptr, end);
+    }
+    return true;
+}
+
+// tANS / FSE, espejo del compresor: dos estados alternan entre símbolos y
+// los bits se leen hacia atrás desde la marca final del bloque
+const int FSE_MAX_TABLE_LOG = 15;
+
+struct FseDecodeEntry {
+    uint16_t newState;
+    unsigned char symbol;
+    unsigned char nbBits;
+};
+
+struct FseDecodeTable {
+    int tableLog = 0;
+    vector<FseDecodeEntry> entries;
+};
+
+inline int highBit(uint32_t value) {
+    int bit = 0;
+    while (value >>= 1) bit++;
+    return bit;
+}
+
+// Lee la cabecera compacta de writeFseCounts() y reparte los símbolos por la tabla
+bool buildFseDecodeTable(const vector<unsigned char>& tables, FseDecodeTable& table) {
+    BitReader reader(tables.data(), tables.size());
+    int tableLog = static_cast<int>(reader.read(4));
+    if (tableLog < 8 || tableLog > FSE_MAX_TABLE_LOG) return false;
+    uint32_t tableSize = 1u << tableLog;
+
+    uint32_t norm[256] = {};
+    uint32_t remaining = tableSize;
+    int s = 0;
+    while (remaining > 0) {
+        if (s >= 256) return false;
+        uint32_t count = reader.read(highBit(remaining) + 1);
+        if (count > remaining) return false;
+        norm[s++] = count;
+        remaining -= count;
+        if (count == 0) {
+            uint32_t repeat;
+            do {
+                repeat = reader.read(2);
+                s += repeat;
+            } while (repeat == 3);
+        }
+    }
 
-    if (str[index] == '1') {
-        return new Node(str[++index]);
+    // Mismo reparto que fseSpreadSymbols() en el compresor
+    vector<unsigned char> tableSymbol(tableSize);
+    uint32_t mask = tableSize - 1;
+    uint32_t step = (tableSize >> 1) + (tableSize >> 3) + 3;
+    uint32_t pos = 0;
+    for (int sym = 0; sym < 256; sym++) {
+        for (uint32_t i = 0; i < norm[sym]; i++) {
+            tableSymbol[pos] = static_cast<unsigned char>(sym);
+            pos = (pos + step) & mask;
+        }
     }
 
-    Node* node = new Node('\0');
-    node->left = deserializeHuffmanTree(str, ++index);
-    node->right = deserializeHuffmanTree(str, ++index);
-    return node;
+    table.tableLog = tableLog;
+    table.entries.resize(tableSize);
+    uint32_t symbolNext[256];
+    for (int sym = 0; sym < 256; sym++) symbolNext[sym] = norm[sym];
+    for (uint32_t u = 0; u < tableSize; u++) {
+        unsigned char sym = tableSymbol[u];
+        uint32_t nextState = symbolNext[sym]++;
+        int nbBits = tableLog - highBit(nextState);
+        table.entries[u] = FseDecodeEntry{static_cast<uint16_t>((nextState << nbBits) - tableSize), sym, static_cast<unsigned char>(nbBits)};
+    }
+    return true;
 }
 
-string decode(Node* root, const string& encodedData) {
-    string decodedString;
-    Node* curr = root;
-    for (char bit : encodedData) {
-        if (bit == '0') {
-            curr = curr->left;
+// Lector de bits hacia atrás sobre un flujo MSB-first: cada lectura toma los
+// n bits inmediatamente anteriores a la posición actual
+struct BackwardBitReader {
+    const unsigned char* data;
+    size_t size;
+    size_t bitPos = 0;
+
+    BackwardBitReader(const unsigned char* d, size_t n) : data(d), size(n) {}
+
+    // Se coloca justo antes de la marca final (el último bit a 1 del flujo)
+    bool init() {
+        size_t last = size;
+        while (last > 0 && data[last - 1] == 0) last--;
+        if (last == 0) return false;
+        unsigned char byte = data[last - 1];
+        int trailing = 0;
+        while (!(byte & (1 << trailing))) trailing++;
+        bitPos = last * 8 - trailing - 1;
+        return true;
+    }
+
+    uint32_t read(int n) {
+        if (n == 0) return 0;
+        if (static_cast<size_t>(n) > bitPos) n = static_cast<int>(bitPos); // flujo corrupto
+        bitPos -= n;
+        size_t byte = bitPos >> 3;
+        uint32_t window = 0;
+        for (int i = 0; i < 4; i++) {
+            window = (window << 8) | (byte + i < size ? data[byte + i] : 0);
+        }
+        return (window << (bitPos & 7)) >> (32 - n);
+    }
+};
+
+bool decodeFse(const FseDecodeTable& table, const unsigned char* in, size_t size, unsigned char* out, size_t count) {
+    BackwardBitReader reader(in, size);
+    if (!reader.init()) return false;
+    uint32_t state[2];
+    state[0] = reader.read(table.tableLog);
+    state[1] = reader.read(table.tableLog);
+
+    const FseDecodeEntry* entries = table.entries.data();
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const FseDecodeEntry& e0 = entries[state[0]];
+        out[i] = e0.symbol;
+        state[0] = e0.newState + reader.read(e0.nbBits);
+        const FseDecodeEntry& e1 = entries[state[1]];
+        out[i + 1] = e1.symbol;
+        state[1] = e1.newState + reader.read(e1.nbBits);
+    }
+    if (i < count) {
+        out[i] = entries[state[0]].symbol;
+    }
+    return true;
+}
+
+// Modo "max": decodificador aritmético binario adaptativo, espejo de
+// encodeArithStripe(). Por cada residuo MED plegado se decodifica primero si
+// es cero y, si no lo es, su valor menos uno baja por un árbol binario. Ambos
+// se eligen por la actividad local y por el residuo de la componente anterior
+// en el mismo píxel; la decisión de cero mira además si el residuo de la
+// izquierda fue cero.
+const int ARITH_ACTIVITY_BUCKETS = 10;
+const int ARITH_COMPONENT_BUCKETS = 4;
+// Probabilidades de 16 bits, media de una estimación rápida y una lenta
+const int ARITH_PROB_BITS = 16;
+const int ARITH_FAST_BITS = 4;
+const int ARITH_SLOW_BITS = 7;
+
+struct ArithProb {
+    uint16_t fast = 1 << (ARITH_PROB_BITS - 1);
+    uint16_t slow = 1 << (ARITH_PROB_BITS - 1);
+
+    uint32_t zero() const { return (static_cast<uint32_t>(fast) + slow) >> 1; }
+
+    void update(int bit) {
+        if (bit == 0) {
+            fast += ((1 << ARITH_PROB_BITS) - fast) >> ARITH_FAST_BITS;
+            slow += ((1 << ARITH_PROB_BITS) - slow) >> ARITH_SLOW_BITS;
         } else {
-            curr = curr->right;
+            fast -= fast >> ARITH_FAST_BITS;
+            slow -= slow >> ARITH_SLOW_BITS;
         }
+    }
+};
+
+struct RangeDecoder {
+    const unsigned char* ptr;
+    const unsigned char* end;
+    uint32_t range = 0xFFFFFFFF;
+    uint32_t code = 0;
+
+    RangeDecoder(const unsigned char* data, size_t size) : ptr(data), end(data + size) {
+        for (int i = 0; i < 5; i++) code = (code << 8) | nextByte();
+    }
 
-        if (!curr->left && !curr->right) {
-            decodedString += curr->ch;
-            curr = root;
+    // Más allá del final se leen ceros, como los que el codificador no llegó a escribir
+    uint32_t nextByte() {
+        return ptr < end ? *ptr++ : 0;
+    }
+
+    int decodeBit(ArithProb& prob) {
+        uint32_t bound = (range >> ARITH_PROB_BITS) * prob.zero();
+        int bit;
+        if (code < bound) {
+            range = bound;
+            bit = 0;
+        } else {
+            code -= bound;
+            range -= bound;
+            bit = 1;
         }
+        prob.update(bit);
+        while (range < (1u << 24)) {
+            range <<= 8;
+            code = (code << 8) | nextByte();
+        }
+        return bit;
     }
-    return decodedString;
+};
+
+struct ArithModel {
+    ArithProb zero[2][ARITH_COMPONENT_BUCKETS][ARITH_ACTIVITY_BUCKETS];
+    ArithProb tree[ARITH_COMPONENT_BUCKETS][ARITH_ACTIVITY_BUCKETS][256];
+};
+
+inline int arithActivityBucket(int a, int b, int c, int d) {
+    int activity = abs(d - b) + abs(b - c) + abs(c - a);
+    return min(ARITH_ACTIVITY_BUCKETS - 1, highBit(static_cast<uint32_t>(activity) + 1));
+}
+
+inline int arithComponentBucket(unsigned char previousResidual) {
+    return min(ARITH_COMPONENT_BUCKETS - 1, highBit(static_cast<uint32_t>(previousResidual) + 1) / 2);
+}
+
+bool decodeArithStripe(const unsigned char* encoded, size_t size, unsigned char* out, size_t count, int width, int channels) {
+    size_t rowBytes = static_cast<size_t>(width) * channels;
+    if (count % rowBytes != 0 || size < 5) return false;
+    int rows = static_cast<int>(count / rowBytes);
+    RangeDecoder decoder(encoded, size);
+    unique_ptr<ArithModel> model(new ArithModel());
+    vector<unsigned char> previousResidual(static_cast<size_t>(width) * rows, 0);
+
+    for (int comp = 0; comp < channels; comp++) {
+        *model = ArithModel();
+        vector<int> prevLine(width + 2, 0), curLine(width + 2, 0);
+        for (int y = 0; y < rows; y++) {
+            curLine[0] = prevLine[1];
+            prevLine[width + 1] = prevLine[width];
+
+            int leftFolded = 0;
+            for (int x = 0; x < width; x++) {
+                int a = curLine[x], b = prevLine[x + 1], c = prevLine[x], d = prevLine[x + 2];
+                unsigned char& other = previousResidual[static_cast<size_t>(y) * width + x];
+                int component = comp > 0 ? arithComponentBucket(other) : 0;
+                int activity = arithActivityBucket(a, b, c, d);
+                int folded = 0;
+                if (decoder.decodeBit(model->zero[leftFolded != 0][component][activity])) {
+                    ArithProb* probs = model->tree[component][activity];
+                    int node = 1;
+                    for (int bit = 0; bit < 8; bit++) node = node * 2 + decoder.decodeBit(probs[node]);
+                    folded = node - 256 + 1;
+                }
+                other = static_cast<unsigned char>(folded);
+                leftFolded = folded;
+
+                int err = (folded & 1) ? -(folded + 1) / 2 : folded / 2;
+                curLine[x + 1] = (locoMedPredict(a, b, c) + err) & 0xFF;
+            }
+
+            unsigned char* row = out + y * rowBytes + comp;
+            for (int i = 0; i < width; i++) row[i * channels] = static_cast<unsigned char>(curLine[i + 1]);
+            swap(prevLine, curLine);
+        }
+    }
+    return true;
+}
+
+// Inverso de forwardColorTransform(): YCoCg-R módulo 256 sobre los tres
+// primeros canales, por bloques de píxeles separados en planos para que el
+// compilador vectorice los pasos de lifting
+const size_t COLOR_BLOCK = 64;
+const size_t COLOR_BLOCKS_PER_TASK = 4096;
+
+template <int Channels>
+void inverseColorKernel(vector<unsigned char>& data) {
+    const size_t channels = Channels;
+    size_t pixels = data.size() / channels;
+    size_t blocks = (pixels + COLOR_BLOCK - 1) / COLOR_BLOCK;
+    parallelFor((blocks + COLOR_BLOCKS_PER_TASK - 1) / COLOR_BLOCKS_PER_TASK, [&](size_t task) {
+        unsigned char y[COLOR_BLOCK] = {}, co[COLOR_BLOCK] = {}, cg[COLOR_BLOCK] = {};
+        size_t end = min(pixels, (task + 1) * COLOR_BLOCKS_PER_TASK * COLOR_BLOCK);
+        for (size_t first = task * COLOR_BLOCKS_PER_TASK * COLOR_BLOCK; first < end; first += COLOR_BLOCK) {
+            size_t n = min(COLOR_BLOCK, end - first);
+            unsigned char* p = &data[first * channels];
+            for (size_t i = 0; i < n; i++) {
+                y[i] = p[i * channels];
+                co[i] = p[i * channels + 1];
+                cg[i] = p[i * channels + 2];
+            }
+            // Pasada completa: con un número fijo de iteraciones se vectoriza con -O2
+            for (size_t i = 0; i < COLOR_BLOCK; i++) {
+                unsigned char t = y[i] - (static_cast<signed char>(cg[i]) >> 1);
+                unsigned char g = cg[i] + t;
+                unsigned char b = t - (static_cast<signed char>(co[i]) >> 1);
+                y[i] = b + co[i];
+                co[i] = g;
+                cg[i] = b;
+            }
+            for (size_t i = 0; i < n; i++) {
+                p[i * channels] = y[i];
+                p[i * channels + 1] = co[i];
+                p[i * channels + 2] = cg[i];
+            }
+        }
+    });
+}
+
+void inverseColorTransform(vector<unsigned char>& data, int channels) {
+    if (channels == 3) {
+        inverseColorKernel<3>(data);
+    } else {
+        inverseColorKernel<4>(data);
+    }
+}
+
+// Sustituye cada índice por su color de la paleta. Un índice fuera de la
+// paleta indica un archivo dañado.
+bool expandPalette(vector<unsigned char>& data, int channels, const unsigned char* palette, size_t colors) {
+    vector<unsigned char> expanded(data.size() * channels);
+    for (size_t i = 0; i < data.size(); i++) {
+        if (data[i] >= colors) return false;
+        memcpy(&expanded[i * channels], palette + data[i] * channels, channels);
+    }
+    data.swap(expanded);
+    return true;
+}
+
+// Deshace la reducción de canales: el gris se replica en R, G y B y el alfa
+// constante se vuelve a escribir. De los canales guardados y los originales
+// se deduce qué se quitó: 2->1 y 4->3 quitan el alfa, 3->1 el color, 4->2 el
+// color conservando el alfa y 4->1 ambos.
+template <typename Sample>
+bool expandChannels(vector<Sample>& data, int stored, int original, Sample alpha) {
+    if (original < 2 || original > 4 || stored < 1 || stored >= original) return false;
+    bool hasAlpha = original == 2 || original == 4;
+    bool gray = original >= 3 && stored < 3;
+    int colorStored = gray || original < 3 ? 1 : 3;
+    bool keptAlpha = hasAlpha && stored == colorStored + 1;
+    if (stored != colorStored + (keptAlpha ? 1 : 0)) return false;
+
+    size_t pixels = data.size() / stored;
+    vector<Sample> expanded(pixels * original);
+    int colorOut = original >= 3 ? 3 : 1;
+    for (size_t i = 0; i < pixels; i++) {
+        const Sample* in = &data[i * stored];
+        Sample* out = &expanded[i * original];
+        for (int c = 0; c < colorOut; c++) out[c] = in[gray ? 0 : c];
+        if (hasAlpha) out[original - 1] = keptAlpha ? in[stored - 1] : alpha;
+    }
+    data.swap(expanded);
+    return true;
+}
+
+// Devuelve los bits bajos constantes que el compresor quitó
+template <typename Sample>
+void restoreLowBits(vector<Sample>& data, int shift, Sample low) {
+    for (Sample& v : data) v = static_cast<Sample>((v << shift) | low);
+}
+
+// Las imágenes de 16 bits llegan como pares de canales de bytes (alto, bajo)
+// por muestra; los residuos del filtro vienen además en zigzag
+inline uint16_t unzigzag16(uint16_t v) {
+    return static_cast<uint16_t>((v >> 1) ^ (v & 1 ? 0xFFFF : 0));
+}
+
+vector<uint16_t> mergeBytePlanes(const vector<unsigned char>& bytes, bool residuals) {
+    vector<uint16_t> samples(bytes.size() / 2);
+    for (size_t i = 0; i < samples.size(); i++) {
+        uint16_t v = static_cast<uint16_t>((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+        samples[i] = residuals ? unzigzag16(v) : v;
+    }
+    return samples;
+}
+
+// Lee una muestra de los parámetros de las transformaciones (orden del host)
+uint16_t readSample(const string& data, size_t pos, size_t sampleSize) {
+    if (sampleSize == 1) return static_cast<unsigned char>(data[pos]);
+    uint16_t value;
+    memcpy(&value, data.data() + pos, sizeof(value));
+    return value;
+}
+
+// stbi_write solo escribe 8 bits, así que las imágenes de 16 bits se guardan
+// como PGM/PPM (o PAM si tienen alfa) con maxval 65535, en big-endian como
+// pide el formato. Devuelve el nombre del archivo escrito.
+string saveWideImage(const vector<uint16_t>& samples, int width, int height, int channels) {
+    string filename;
+    ostringstream header;
+    if (channels == 1 || channels == 3) {
+        filename = channels == 1 ? "imagenRecuperada.pgm" : "imagenRecuperada.ppm";
+        header << (channels == 1 ? "P5" : "P6") << "\n" << width << " " << height << "\n65535\n";
+    } else {
+        filename = "imagenRecuperada.pam";
+        header << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH " << channels
+               << "\nMAXVAL 65535\nTUPLTYPE " << (channels == 2 ? "GRAYSCALE_ALPHA" : "RGB_ALPHA") << "\nENDHDR\n";
+    }
+    vector<unsigned char> bytes(samples.size() * 2);
+    for (size_t i = 0; i < samples.size(); i++) {
+        bytes[2 * i] = static_cast<unsigned char>(samples[i] >> 8);
+        bytes[2 * i + 1] = static_cast<unsigned char>(samples[i]);
+    }
+    ofstream outFile(filename, ios::binary);
+    outFile << header.str();
+    outFile.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return filename;
 }
 
 void saveImage(const vector<unsigned char>& imageData, int width, int height, int channels, const string& filename) {
     stbi_write_jpg(filename.c_str(), width, height, channels, imageData.data(), 100);
 }
 
-void readFromFile(const string& filename, string& encodedData, string& serializedTree, string& patientData, int& width, int& height, int& channels) {
+void readFromFile(const string& filename, PapHeader& header, string& encodedData, vector<unsigned char>& codeLengths, string& patientData) {
     ifstream inFile(filename, ios::binary);
     if (!inFile) {
         cerr << "Error opening file for reading." << endl;
         return;
     }
 
-    inFile.read(reinterpret_cast<char*>(&width), sizeof(width));
-    inFile.read(reinterpret_cast<char*>(&height), sizeof(height));
-    inFile.read(reinterpret_cast<char*>(&channels), sizeof(channels));
+    inFile.read(reinterpret_cast<char*>(&header.width), sizeof(header.width));
+    inFile.read(reinterpret_cast<char*>(&header.height), sizeof(header.height));
+    inFile.read(reinterpret_cast<char*>(&header.channels), sizeof(header.channels));
+
+    inFile.read(reinterpret_cast<char*>(&header.codec), sizeof(header.codec));
+    inFile.read(reinterpret_cast<char*>(&header.transforms), sizeof(header.transforms));
+    uint32_t transformDataSize = 0;
+    inFile.read(reinterpret_cast<char*>(&transformDataSize), sizeof(transformDataSize));
+    header.transformData.resize(transformDataSize);
+    inFile.read(&header.transformData[0], transformDataSize);
 
     uint32_t encodedSize;
     inFile.read(reinterpret_cast<char*>(&encodedSize), sizeof(encodedSize));
-    vector<char> compressedData(encodedSize);
-    inFile.read(compressedData.data(), encodedSize);
+    encodedData.resize(encodedSize);
+    inFile.read(&encodedData[0], encodedSize);
 
     uint32_t encodedPatientDataSize;
     inFile.read(reinterpret_cast<char*>(&encodedPatientDataSize), sizeof(encodedPatientDataSize));
     vector<char> compressedPatientData(encodedPatientDataSize);
     inFile.read(compressedPatientData.data(), encodedPatientDataSize);
 
-    uint32_t treeSize;
-    inFile.read(reinterpret_cast<char*>(&treeSize), sizeof(treeSize));
-    vector<char> compressedTree(treeSize);
-    inFile.read(compressedTree.data(), treeSize);
+    uint32_t tableSize;
+    inFile.read(reinterpret_cast<char*>(&tableSize), sizeof(tableSize));
+    codeLengths.resize(tableSize);
+    inFile.read(reinterpret_cast<char*>(codeLengths.data()), tableSize);
 
     inFile.close();
 
@@ -160,60 +1466,287 @@ void readFromFile(const string& filename, string& encodedData, string& serialize
 
     string decryptedCompressedPatientData = hillDecipher(string(compressedPatientData.begin(), compressedPatientData.end()), key, mod);
     cout << "Decompressed patient data: " << decryptedCompressedPatientData << endl;
+}
 
-    // Descomprimir los datos
-    uLongf decompressedSize = compressedData.size() * 4; // Estimar tamaño descomprimido
-    encodedData.resize(decompressedSize);
-    int res = uncompress(reinterpret_cast<Bytef*>(&encodedData[0]), &decompressedSize, reinterpret_cast<const Bytef*>(compressedData.data()), compressedData.size());
-
-    // Manejar errores de descompresión
-    while (res == Z_BUF_ERROR) {
-        decompressedSize *= 2; // Aumentar el tamaño del buffer
-        encodedData.resize(decompressedSize);
-        res = uncompress(reinterpret_cast<Bytef*>(&encodedData[0]), &decompressedSize, reinterpret_cast<const Bytef*>(compressedData.data()), compressedData.size());
+// Decodifica una sección de datos con su códec; `codeLengths` es el bloque de tablas
+// de ese códec y `out` ya tiene el tamaño de la imagen (o del plano)
+bool decodeData(uint32_t codec, const vector<unsigned char>& codeLengths, const string& encoded, vector<unsigned char>& out, int width, int channels) {
+    switch (codec) {
+    case CODEC_HUFFMAN: {
+        vector<DecodeTable> tables;
+        if (!buildDecodeTables(codeLengths, tables)) {
+            cerr << "Tabla de códigos Huffman inválida." << endl;
+            return false;
+        }
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return inflateAndDecode(tables, chunk, size, out, count);
+        });
     }
-
-    if (res != Z_OK) {
-        cerr << "Error descomprimiendo los datos: " << res << endl;
-        return;
+    case CODEC_STATIC_HUFFMAN: {
+        // Solo se guarda el ID; la tabla viene del registro compilado en TablasHuffman.h
+        uint32_t tableId = 0;
+        const PretrainedHuffmanTable* pretrained = nullptr;
+        if (codeLengths.size() == sizeof(tableId)) {
+            memcpy(&tableId, codeLengths.data(), sizeof(tableId));
+            pretrained = findPretrainedHuffmanTable(tableId);
+        }
+        vector<DecodeTable> tables(1);
+        if (pretrained == nullptr || !buildDecodeTable(pretrained->lengths, tables[0])) {
+            cerr << "Tabla Huffman preentrenada desconocida: " << tableId << endl;
+            return false;
+        }
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return inflateAndDecode(tables, chunk, size, out, count);
+        });
+    }
+    case CODEC_PAIRS: {
+        PairDecodeTable table;
+        if (!buildPairDecodeTable(codeLengths, table)) {
+            cerr << "Tabla de códigos de pares inválida." << endl;
+            return false;
+        }
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return inflateAndDecodePairs(table, chunk, size, out, count);
+        });
     }
-    encodedData.resize(decompressedSize);
+    case CODEC_BWT: {
+        DecodeTable table;
+        if (codeLengths.size() != 256 || !buildDecodeTable(codeLengths.data(), table)) {
+            cerr << "Tabla de códigos Huffman inválida." << endl;
+            return false;
+        }
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return decodeBwtBlock(table, chunk, size, out, count);
+        });
+    }
+    case CODEC_LZ: {
+        // Las cuatro tablas vienen comprimidas con zlib
+        vector<unsigned char> lengths(LZ_STREAMS * 256);
+        uLongf lengthsSize = lengths.size();
+        vector<DecodeTable> tables;
+        if (uncompress(lengths.data(), &lengthsSize, codeLengths.data(), codeLengths.size()) != Z_OK ||
+            lengthsSize != lengths.size() || !buildDecodeTables(lengths, tables)) {
+            cerr << "Tablas de códigos LZ inválidas." << endl;
+            return false;
+        }
+        size_t stride = static_cast<size_t>(width) * channels;
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return decodeLzStripe(tables, chunk, size, out, count, stride, channels);
+        });
+    }
+    case CODEC_RLE: {
+        DecodeTable table;
+        if (codeLengths.size() != 256 || !buildDecodeTable(codeLengths.data(), table)) {
+            cerr << "Tabla de códigos Huffman inválida." << endl;
+            return false;
+        }
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return inflateAndExpandRuns(table, chunk, size, out, count);
+        });
+    }
+    case CODEC_STREAM:
+        return inflateAndDecodeStream(reinterpret_cast<const unsigned char*>(encoded.data()), encoded.size(), out, width, channels);
+    case CODEC_RANS: {
+        RansDecodeTable table;
+        if (!buildRansDecodeTable(codeLengths, table)) {
+            cerr << "Tabla de frecuencias rANS inválida." << endl;
+            return false;
+        }
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return decodeRans(table, chunk, size, out, count);
+        });
+    }
+    case CODEC_FSE: {
+        FseDecodeTable table;
+        if (!buildFseDecodeTable(codeLengths, table)) {
+            cerr << "Tabla FSE inválida." << endl;
+            return false;
+        }
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return decodeFse(table, chunk, size, out, count);
+        });
+    }
+    case CODEC_LOCO:
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return decodeLocoStripe(chunk, size, out, count, width, channels);
+        });
+    case CODEC_ARITH:
+        return unpackChunks(encoded, out, [&](const unsigned char* chunk, size_t size, unsigned char* out, size_t count) {
+            return decodeArithStripe(chunk, size, out, count, width, channels);
+        });
+    default:
+        cerr << "Códec desconocido: " << codec << endl;
+        return false;
+    }
+}
 
-    // Descomprimir el árbol
-    uLongf decompressedTreeSize = compressedTree.size() * 4; // Estimar tamaño descomprimido
-    serializedTree.resize(decompressedTreeSize);
-    res = uncompress(reinterpret_cast<Bytef*>(&serializedTree[0]), &decompressedTreeSize, reinterpret_cast<const Bytef*>(compressedTree.data()), compressedTree.size());
+// Modo planar: cada canal es una sección "u32 tamaño + datos" con sus propias
+// tablas, en el mismo orden en ambos bloques; los planos se decodifican en
+// paralelo y luego se vuelven a entrelazar
+bool readSection(const string& data, size_t& pos, string& section) {
+    uint32_t size;
+    if (!readU32(data, pos, size) || pos + size > data.size()) return false;
+    section = data.substr(pos, size);
+    pos += size;
+    return true;
+}
 
-    // Manejar errores de descompresión
-    while (res == Z_BUF_ERROR) {
-        decompressedTreeSize *= 2; // Aumentar el tamaño del buffer
-        serializedTree.resize(decompressedTreeSize);
-        res = uncompress(reinterpret_cast<Bytef*>(&serializedTree[0]), &decompressedTreeSize, reinterpret_cast<const Bytef*>(compressedTree.data()), compressedTree.size());
+bool decodePlanar(const PapHeader& header, const vector<unsigned char>& codeLengths, const string& encoded, vector<unsigned char>& out) {
+    size_t planeSize = static_cast<size_t>(header.width) * header.height;
+    string tablesBlob(codeLengths.begin(), codeLengths.end());
+    vector<string> sections(header.channels), tables(header.channels);
+    size_t dataPos = 0, tablePos = 0;
+    for (int c = 0; c < header.channels; c++) {
+        if (!readSection(encoded, dataPos, sections[c]) || !readSection(tablesBlob, tablePos, tables[c])) return false;
     }
 
-    if (res != Z_OK) {
-        cerr << "Error descomprimiendo el árbol: " << res << endl;
-        return;
-    }
-    serializedTree.resize(decompressedTreeSize);
+    atomic<bool> ok(true);
+    parallelFor(header.channels, [&](size_t c) {
+        vector<unsigned char> plane(planeSize);
+        vector<unsigned char> planeTables(tables[c].begin(), tables[c].end());
+        if (!decodeData(header.codec, planeTables, sections[c], plane, header.width, 1)) {
+            ok = false;
+            return;
+        }
+        for (size_t i = 0; i < planeSize; i++) out[i * header.channels + c] = plane[i];
+    });
+    return ok;
 }
 
 int main() {
-    string patientData, encodedData, serializedTree;
-    int width, height, channels;
+    string patientData, encodedData;
+    vector<unsigned char> codeLengths;
+    PapHeader header;
 
-    readFromFile("compressed.pap", encodedData, serializedTree, patientData, width, height, channels);
+    readFromFile("compressed.pap", header, encodedData, codeLengths, patientData);
+    int width = header.width, height = header.height, channels = header.channels;
 
-    int index = 0;
-    Node* root = deserializeHuffmanTree(serializedTree, index);
+    // Descomprimir y decodificar los bloques en paralelo
+    vector<unsigned char> imageData(static_cast<size_t>(width) * height * channels);
+    bool ok = (header.transforms & TRANSFORM_PLANAR)
+        ? decodePlanar(header, codeLengths, encodedData, imageData)
+        : decodeData(header.codec, codeLengths, encodedData, imageData, width, channels);
+    if (!ok) {
+        cerr << "Error decodificando los bloques de la imagen." << endl;
+        return -1;
+    }
+
+    // Las imágenes de 16 bits siempre van en modo planar, con dos canales de
+    // bytes por muestra, y no usan ni paleta ni transformación de color
+    bool wide = (header.transforms & TRANSFORM_WIDE) != 0;
+    size_t sampleSize = wide ? 2 : 1;
+    if (wide) {
+        if (channels % 2 != 0 || !(header.transforms & TRANSFORM_PLANAR) ||
+            (header.transforms & (TRANSFORM_COLOR | TRANSFORM_PALETTE))) {
+            cerr << "Cabecera de imagen de 16 bits inválida." << endl;
+            return -1;
+        }
+        channels /= 2;
+    }
 
-    string decodedString = decode(root, encodedData);
-    vector<unsigned char> imageData(decodedString.begin(), decodedString.end());
+    // Deshacer las transformaciones; sus parámetros están en el orden en que se
+    // aplicaron, así que los de la reducción (la primera etapa) van delante
+    size_t transformPos = 0;
+    int originalChannels = channels;
+    uint16_t constantAlpha = 0;
+    if (header.transforms & TRANSFORM_REDUCE) {
+        if (header.transformData.size() < transformPos + 1 + sampleSize) {
+            cerr << "Parámetros de reducción de canales inválidos." << endl;
+            return -1;
+        }
+        originalChannels = static_cast<unsigned char>(header.transformData[transformPos]);
+        constantAlpha = readSample(header.transformData, transformPos + 1, sampleSize);
+        transformPos += 1 + sampleSize;
+    }
+    int paletteChannels = channels;
+    size_t paletteColors = 0;
+    const unsigned char* palette = nullptr;
+    if (header.transforms & TRANSFORM_PALETTE) {
+        const unsigned char* params = reinterpret_cast<const unsigned char*>(header.transformData.data()) + transformPos;
+        if (header.transformData.size() < transformPos + 2 || channels != 1) {
+            cerr << "Parámetros de paleta inválidos." << endl;
+            return -1;
+        }
+        paletteChannels = params[0];
+        paletteColors = params[1] + size_t(1);
+        palette = params + 2;
+        transformPos += 2 + paletteColors * paletteChannels;
+        if (paletteChannels < 2 || paletteChannels > 4 || header.transformData.size() < transformPos) {
+            cerr << "Parámetros de paleta inválidos." << endl;
+            return -1;
+        }
+    }
+    int lowShift = 0;
+    uint16_t lowValue = 0;
+    if (header.transforms & TRANSFORM_LOW_BITS) {
+        if (header.transformData.size() < transformPos + 1 + sampleSize) {
+            cerr << "Parámetros de bits bajos inválidos." << endl;
+            return -1;
+        }
+        lowShift = static_cast<unsigned char>(header.transformData[transformPos]);
+        lowValue = readSample(header.transformData, transformPos + 1, sampleSize);
+        transformPos += 1 + sampleSize;
+        if (lowShift < 1 || lowShift >= static_cast<int>(8 * sampleSize) || (lowValue >> lowShift) != 0) {
+            cerr << "Parámetros de bits bajos inválidos." << endl;
+            return -1;
+        }
+    }
+
+    vector<uint16_t> wideData;
+    if (wide) {
+        wideData = mergeBytePlanes(imageData, (header.transforms & TRANSFORM_FILTER) != 0);
+        vector<unsigned char>().swap(imageData);
+    }
+    if (header.transforms & TRANSFORM_FILTER) {
+        const unsigned char* rowFilters = reinterpret_cast<const unsigned char*>(header.transformData.data()) + transformPos;
+        if (header.transformData.size() < transformPos + height ||
+            !(wide ? unfilterImage(wideData, width, height, channels, rowFilters)
+                   : unfilterImage(imageData, width, height, channels, rowFilters))) {
+            cerr << "Filtros de fila inválidos." << endl;
+            return -1;
+        }
+        transformPos += height;
+    }
+    if (header.transforms & TRANSFORM_COLOR) {
+        if (channels < 3) {
+            cerr << "Transformación de color sobre una imagen de " << channels << " canales." << endl;
+            return -1;
+        }
+        inverseColorTransform(imageData, channels);
+    }
+    if (header.transforms & TRANSFORM_LOW_BITS) {
+        // Los bits bajos constantes se quitaron antes de filtrar; se devuelven tal cual
+        if (wide) {
+            restoreLowBits(wideData, lowShift, lowValue);
+        } else {
+            restoreLowBits(imageData, lowShift, static_cast<unsigned char>(lowValue));
+        }
+    }
+    if (header.transforms & TRANSFORM_PALETTE) {
+        if (!expandPalette(imageData, paletteChannels, palette, paletteColors)) {
+            cerr << "Índice de paleta fuera de rango." << endl;
+            return -1;
+        }
+        channels = paletteChannels;
+    }
+    if (header.transforms & TRANSFORM_REDUCE) {
+        if (!(wide ? expandChannels(wideData, channels, originalChannels, constantAlpha)
+                   : expandChannels(imageData, channels, originalChannels, static_cast<unsigned char>(constantAlpha)))) {
+            cerr << "Reducción de canales inválida: " << channels << " de " << originalChannels << endl;
+            return -1;
+        }
+        channels = originalChannels;
+    }
 
-    saveImage(imageData, width, height, channels, "imagenRecuperada.jpg");
+    string outputName = "imagenRecuperada.jpg";
+    if (wide) {
+        outputName = saveWideImage(wideData, width, height, channels);
+    } else {
+        saveImage(imageData, width, height, channels, outputName);
+    }
 
     cout << patientData << endl;
-    cout << "Image saved as imagenRecuperada.jpg" << endl;
+    cout << "Image saved as " << outputName << endl;
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+// Pretrained static Huffman tables, generated by "CompresorImagenesHuffman --train=<name> --table-file=<path>".
+// Files coded with --static-table=<id> store only the table ID, so the compressor
+// and RecuperarImagenDatos must be built from the same registry. Do not edit by hand.
+#ifndef TABLAS_HUFFMAN_H
+#define TABLAS_HUFFMAN_H
+
+#include <cstdint>
+
+struct PretrainedHuffmanTable {
+    uint32_t id;  // 0 ends the registry
+    const char* name;
+    unsigned char lengths[256];
+};
+
+static const PretrainedHuffmanTable kPretrainedHuffmanTables[] = {
+    {1, "samples", {
+        2, 3, 4, 4, 5, 6, 6, 7, 7, 8, 8, 8, 9, 9, 10, 10,
+        10, 11, 11, 11, 11, 11, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+        12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 11, 11, 11, 11,
+        10, 10, 10, 9, 9, 8, 8, 8, 7, 7, 6, 6, 5, 4, 4, 3
+    }},
+    {0, nullptr, {}}
+};
+
+inline const PretrainedHuffmanTable* findPretrainedHuffmanTable(uint32_t id) {
+    for (const PretrainedHuffmanTable* table = kPretrainedHuffmanTables; table->id != 0; table++) {
+        if (table->id == id) return table;
+    }
+    return nullptr;
+}
+
+#endif